@@ -0,0 +1,121 @@
+#include "game.h"
+
+/*
+ * Animation timeline.
+ *
+ * Every running animation of a game is a tween in one packed array that
+ * is advanced by a single loop.  A tween eases a float from one value to
+ * another, optionally after a delay, and calls its completion function
+ * when done.  Tweens that finish in the same update complete in order of
+ * their order field, so gameplay sees them in a well defined sequence.
+ * While any blocking tween runs the board counts as moving; the update
+ * that finishes the last one reports that the board has settled.
+ */
+
+/* Which kinds hold the board still, and which only run while it is. */
+static const struct {
+	Uint8 blocking;
+	Uint8 when_still;
+} kinds[NR_ANIM_KINDS] = {
+	[ANIM_ROTATE] = { 1, 0 },
+	[ANIM_SLIDE] = { 1, 0 },
+	[ANIM_FALL] = { 1, 0 },
+	[ANIM_RISE] = { 0, 1 },
+};
+
+static float ease(enum ease ease, float x)
+{
+	switch (ease) {
+	case EASE_IN:
+		return x * x;
+	case EASE_OUT:
+		return x * (2 - x);
+	case EASE_IN_OUT:
+		return x < 0.5 ? 2 * x * x : -1 + (4 - 2 * x) * x;
+	case EASE_LINEAR:
+	default:
+		return x;
+	}
+}
+
+void anim_reset(struct anim *anim)
+{
+	memset(anim, 0, sizeof(*anim));
+}
+
+struct tween *anim_add(struct anim *anim, enum anim_kind kind, float *value,
+		       float from, float to, float duration, anim_done_fn done)
+{
+	struct tween *tw;
+
+	assert(anim->nr_tweens < MAX_TWEENS);
+
+	tw = &anim->tweens[anim->nr_tweens++];
+	memset(tw, 0, sizeof(*tw));
+	tw->value = value;
+	tw->from = from;
+	tw->to = to;
+	tw->duration = duration;
+	tw->kind = kind;
+	tw->done = done;
+
+	if (value)
+		*value = from;
+
+	anim->blocking += kinds[kind].blocking;
+	anim->active[kind]++;
+
+	return tw;
+}
+
+/* Advances every tween; returns 1 if the board has just settled. */
+int anim_update(struct game *g, float dt)
+{
+	struct anim *anim = &g->anim;
+	struct tween finished[MAX_TWEENS];
+	struct tween tmp, *tw;
+	int nr_finished = 0;
+	int was_blocking = anim->blocking > 0;
+	int i, k;
+
+	for (i = 0; i < anim->nr_tweens; ) {
+		tw = &anim->tweens[i];
+
+		if (kinds[tw->kind].when_still && anim->blocking) {
+			i++;
+			continue;
+		}
+
+		tw->t += dt;
+
+		if (tw->t < tw->duration) {
+			if (tw->value && tw->t > 0)
+				*tw->value = tw->from + (tw->to - tw->from)
+					* ease(tw->ease, tw->t / tw->duration);
+			i++;
+			continue;
+		}
+
+		if (tw->value)
+			*tw->value = tw->to;
+
+		/* Keep finished tweens sorted by order. */
+		for (k = nr_finished++; k > 0
+			     && finished[k - 1].order > tw->order; k--)
+			finished[k] = finished[k - 1];
+		finished[k] = *tw;
+
+		*tw = anim->tweens[--anim->nr_tweens];
+	}
+
+	for (i = 0; i < nr_finished; i++) {
+		tmp = finished[i];
+		if (tmp.done)
+			tmp.done(g, &tmp);
+
+		anim->blocking -= kinds[tmp.kind].blocking;
+		anim->active[tmp.kind]--;
+	}
+
+	return was_blocking && anim->blocking == 0;
+}
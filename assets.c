@@ -0,0 +1,166 @@
+#include "game.h"
+
+/*
+ * Progressive asset loading.
+ *
+ * assets_start() gives every sprite a solid placeholder of its final
+ * size, so the first frame can be drawn at once, and starts a thread
+ * that decodes the image files in the order below.  Each decoded image
+ * is handed over through its own slot; assets_poll(), called by the
+ * main thread every frame, turns it into a sprite and swaps it in for
+ * the placeholder.  Only decoding happens off the main thread.
+ */
+
+struct asset {
+	struct sprite *sprite;
+	const char *filename;
+	Uint16 w, h;
+	Uint32 colour;		/* ARGB of the placeholder */
+};
+
+/* Board tiles first: they cover most of the screen. */
+static const struct asset assets[] = {
+	{ &images.black_image, "assets/black.png", 32, 32, 0xFF303030 },
+	{ &images.white_image, "assets/white.png", 32, 32, 0xFFD0D0D0 },
+	{ &images.background, "assets/space.png", 640, 480, 0xFF000010 },
+	{ &images.black_to_white[0], "assets/bw1.png", 32, 32, 0xFF505050 },
+	{ &images.black_to_white[1], "assets/bw2.png", 32, 32, 0xFF707070 },
+	{ &images.black_to_white[2], "assets/bw3.png", 32, 32, 0xFF909090 },
+	{ &images.black_to_white[3], "assets/bw4.png", 32, 32, 0xFFB0B0B0 },
+	{ &images.font, "assets/font.png", 320, 32, 0x00000000 },
+	{ &images.black_scale[0], "assets/black_particle1.png", 16, 16,
+	  0xFF303030 },
+	{ &images.black_scale[1], "assets/black_particle2.png", 8, 8,
+	  0xFF303030 },
+	{ &images.black_scale[2], "assets/black_particle3.png", 4, 4,
+	  0xFF303030 },
+	{ &images.white_scale[0], "assets/white_particle1.png", 16, 16,
+	  0xFFD0D0D0 },
+	{ &images.white_scale[1], "assets/white_particle2.png", 8, 8,
+	  0xFFD0D0D0 },
+	{ &images.white_scale[2], "assets/white_particle3.png", 4, 4,
+	  0xFFD0D0D0 },
+};
+
+#define NR_ASSETS ((int) (sizeof(assets) / sizeof(assets[0])))
+
+static struct {
+	SDL_Surface *loaded;	/* set by the loader when decoded */
+	Uint32 decode_us;
+	int done;
+} slots[NR_ASSETS];
+
+static SDL_Thread *loader;
+static int remaining;
+static int quit;
+
+static void decode_all(void)
+{
+	SDL_Surface *s;
+	Uint64 start;
+	int i;
+
+	for (i = 0; i < NR_ASSETS; i++) {
+		if (__atomic_load_n(&quit, __ATOMIC_ACQUIRE))
+			break;
+
+		start = telemetry_now();
+		s = decode_image(assets[i].filename);
+		slots[i].decode_us = telemetry_now() - start;
+		__atomic_store_n(&slots[i].loaded, s, __ATOMIC_RELEASE);
+	}
+}
+
+static int loader_thread(void *data)
+{
+	(void) data;
+
+	flight_thread("loader");
+	decode_all();
+
+	return 0;
+}
+
+static void placeholder(const struct asset *a)
+{
+	SDL_Surface *s;
+
+	s = SDL_CreateRGBSurface(SDL_SWSURFACE, a->w, a->h, 32, 0x00FF0000,
+				 0x0000FF00, 0x000000FF, 0xFF000000);
+	if (s == NULL) {
+		fprintf(stderr, "Could not create placeholder for %s.\n",
+			a->filename);
+		assert(0);
+	}
+
+	SDL_FillRect(s, NULL, a->colour);
+	set_image(a->sprite, s);
+}
+
+void assets_start(void)
+{
+	int i;
+
+	blit_init();
+
+	memset(slots, 0, sizeof(slots));
+	for (i = 0; i < NR_ASSETS; i++)
+		placeholder(&assets[i]);
+
+	remaining = NR_ASSETS;
+	quit = 0;
+
+	loader = SDL_CreateThread(loader_thread, NULL);
+	if (loader == NULL) {
+		/* Decode here instead; slower to start but complete. */
+		fprintf(stderr, "Could not start loader thread: %s\n",
+			SDL_GetError());
+		decode_all();
+	}
+}
+
+/* Swaps in whatever has been decoded; returns how many are left. */
+int assets_poll(void)
+{
+	SDL_Surface *s;
+	int i;
+
+	for (i = 0; i < NR_ASSETS && remaining > 0; i++) {
+		if (slots[i].done)
+			continue;
+
+		s = __atomic_load_n(&slots[i].loaded, __ATOMIC_ACQUIRE);
+		if (s == NULL)
+			continue;
+
+		free_image(assets[i].sprite);
+		set_image(assets[i].sprite, s);
+		flight_asset(assets[i].filename, slots[i].decode_us);
+		slots[i].loaded = NULL;
+		slots[i].done = 1;
+
+		if (--remaining == 0 && loader) {
+			SDL_WaitThread(loader, NULL);
+			loader = NULL;
+		}
+	}
+
+	return remaining;
+}
+
+void assets_free(void)
+{
+	int i;
+
+	if (loader) {
+		__atomic_store_n(&quit, 1, __ATOMIC_RELEASE);
+		SDL_WaitThread(loader, NULL);
+		loader = NULL;
+	}
+
+	for (i = 0; i < NR_ASSETS; i++) {
+		SDL_FreeSurface(slots[i].loaded);
+		slots[i].loaded = NULL;
+		free_image(assets[i].sprite);
+	}
+}
@@ -0,0 +1,303 @@
+#include "game.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <emmintrin.h>
+#define AUDIO_X86
+#endif
+
+/*
+ * Sound effects.
+ *
+ * Every effect is decoded to mono 16-bit PCM at startup, either from
+ * assets/<name>.wav or, when that file is missing, synthesised.  The
+ * game thread starts a voice by pushing the effect number on a
+ * single-producer ring; the audio callback drains the ring and mixes
+ * the active voices with saturating adds.  The callback never locks or
+ * allocates.
+ */
+
+#define AUDIO_RATE 44100
+#define AUDIO_SAMPLES 256	/* ~5.8 ms per callback */
+#define AUDIO_VOICES 16
+#define AUDIO_QUEUE 64		/* power of two */
+
+struct sample {
+	Sint16 *data;
+	int len;
+	Sint16 volume;		/* Q15 */
+};
+
+struct voice {
+	const struct sample *sample;
+	int pos;
+};
+
+typedef void (*mix_fn)(Sint16 *out, const Sint16 *in, int n, Sint16 volume);
+
+static struct {
+	int open;
+	struct sample samples[NR_SOUNDS];
+	struct voice voices[AUDIO_VOICES];
+	mix_fn mix;
+
+	Uint8 queue[AUDIO_QUEUE];
+	unsigned int head;	/* written by the game thread */
+	unsigned int tail;	/* written by the audio callback */
+} audio;
+
+static const char *sound_names[NR_SOUNDS] = {
+	[SOUND_CLEAR] = "clear",
+	[SOUND_ROTATE] = "rotate",
+	[SOUND_INVERT] = "invert",
+	[SOUND_RISE] = "rise",
+};
+
+static void mix_c(Sint16 *out, const Sint16 *in, int n, Sint16 volume)
+{
+	int i, s;
+
+	for (i = 0; i < n; i++) {
+		s = out[i] + ((in[i] * volume) >> 15);
+		if (s > 32767)
+			s = 32767;
+		else if (s < -32768)
+			s = -32768;
+		out[i] = s;
+	}
+}
+
+#ifdef AUDIO_X86
+__attribute__((target("sse2")))
+static void mix_sse2(Sint16 *out, const Sint16 *in, int n, Sint16 volume)
+{
+	__m128i v = _mm_set1_epi16(volume);
+	__m128i s, o;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		s = _mm_loadu_si128((const __m128i *) (in + i));
+		/* (s * volume) >> 15, as in mix_c */
+		s = _mm_or_si128(_mm_slli_epi16(_mm_mulhi_epi16(s, v), 1),
+				 _mm_srli_epi16(_mm_mullo_epi16(s, v), 15));
+		o = _mm_loadu_si128((const __m128i *) (out + i));
+		_mm_storeu_si128((__m128i *) (out + i), _mm_adds_epi16(o, s));
+	}
+
+	mix_c(out + i, in + i, n - i, volume);
+}
+#endif
+
+static void start_voice(const struct sample *sample)
+{
+	struct voice *v, *oldest = &audio.voices[0];
+	int i;
+
+	for (i = 0; i < AUDIO_VOICES; i++) {
+		v = &audio.voices[i];
+		if (v->sample == NULL)
+			break;
+		if (v->pos > oldest->pos)
+			oldest = v;
+	}
+
+	if (i == AUDIO_VOICES)
+		v = oldest;
+
+	v->sample = sample;
+	v->pos = 0;
+}
+
+static void audio_callback(void *data, Uint8 *stream, int len)
+{
+	Sint16 *out = (Sint16 *) stream;
+	int n = len / 2;
+	unsigned int tail = audio.tail;
+	unsigned int head = __atomic_load_n(&audio.head, __ATOMIC_ACQUIRE);
+	struct voice *v;
+	int i, count;
+
+	(void) data;
+
+	for (; tail != head; tail++)
+		start_voice(&audio.samples[audio.queue[tail % AUDIO_QUEUE]]);
+	__atomic_store_n(&audio.tail, tail, __ATOMIC_RELEASE);
+
+	memset(stream, 0, len);
+
+	for (i = 0; i < AUDIO_VOICES; i++) {
+		v = &audio.voices[i];
+		if (v->sample == NULL)
+			continue;
+
+		count = v->sample->len - v->pos;
+		if (count > n)
+			count = n;
+
+		audio.mix(out, v->sample->data + v->pos, count,
+			  v->sample->volume);
+
+		v->pos += count;
+		if (v->pos >= v->sample->len)
+			v->sample = NULL;
+	}
+}
+
+/* Sine sweep from f0 to f1 Hz with an exponential decay. */
+static int synth_sweep(struct sample *s, float seconds, float f0, float f1,
+		       float decay, float noise)
+{
+	float phase = 0, t, f;
+	int i;
+
+	s->len = seconds * AUDIO_RATE;
+	s->data = malloc(s->len * sizeof(*s->data));
+	if (s->data == NULL)
+		return 1;
+
+	for (i = 0; i < s->len; i++) {
+		t = (float) i / AUDIO_RATE;
+		f = f0 + (f1 - f0) * t / seconds;
+		phase += 2 * M_PI * f / AUDIO_RATE;
+		s->data[i] = 12000 * expf(-decay * t)
+			* ((1 - noise) * sinf(phase)
+			   + noise * ((rand() % 2001) / 1000.0 - 1));
+	}
+
+	return 0;
+}
+
+static int synth_sound(struct sample *s, enum sound sound)
+{
+	switch (sound) {
+	case SOUND_CLEAR:
+		return synth_sweep(s, 0.35, 880, 220, 8, 0.3);
+	case SOUND_ROTATE:
+		return synth_sweep(s, 0.05, 1200, 900, 60, 0);
+	case SOUND_INVERT:
+		return synth_sweep(s, 0.12, 300, 900, 20, 0);
+	case SOUND_RISE:
+		return synth_sweep(s, 0.15, 110, 90, 20, 0.1);
+	default:
+		return 1;
+	}
+}
+
+static int load_sound(struct sample *s, const char *filename)
+{
+	SDL_AudioSpec spec;
+	SDL_AudioCVT cvt;
+	Uint8 *buf;
+	Uint32 len;
+
+	if (SDL_LoadWAV(filename, &spec, &buf, &len) == NULL)
+		return 1;
+
+	if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq,
+			      AUDIO_S16SYS, 1, AUDIO_RATE) < 0) {
+		SDL_FreeWAV(buf);
+		return 1;
+	}
+
+	cvt.len = len;
+	cvt.buf = malloc(len * cvt.len_mult);
+	if (cvt.buf == NULL) {
+		SDL_FreeWAV(buf);
+		return 1;
+	}
+	memcpy(cvt.buf, buf, len);
+	SDL_FreeWAV(buf);
+
+	if (SDL_ConvertAudio(&cvt) < 0) {
+		free(cvt.buf);
+		return 1;
+	}
+
+	s->data = (Sint16 *) cvt.buf;
+	s->len = cvt.len_cvt / sizeof(*s->data);
+
+	return 0;
+}
+
+int audio_init(void)
+{
+	SDL_AudioSpec desired;
+	char filename[64];
+	char driver[32];
+	int i;
+
+	memset(&audio, 0, sizeof(audio));
+
+	for (i = 0; i < NR_SOUNDS; i++) {
+		snprintf(filename, sizeof(filename), "assets/%s.wav",
+			 sound_names[i]);
+		if (load_sound(&audio.samples[i], filename) != 0
+		    && synth_sound(&audio.samples[i], i) != 0) {
+			fprintf(stderr, "Could not create sound %s.\n",
+				sound_names[i]);
+			return 1;
+		}
+		audio.samples[i].volume = 32767;
+	}
+
+	audio.mix = mix_c;
+#ifdef AUDIO_X86
+	if (__builtin_cpu_supports("sse2"))
+		audio.mix = mix_sse2;
+#endif
+
+	memset(&desired, 0, sizeof(desired));
+	desired.freq = AUDIO_RATE;
+	desired.format = AUDIO_S16SYS;
+	desired.channels = 1;
+	desired.samples = AUDIO_SAMPLES;
+	desired.callback = audio_callback;
+
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+		fprintf(stderr, "Could not start audio: %s\n", SDL_GetError());
+		return 1;
+	}
+
+	/* No obtained spec: SDL converts to this format for us. */
+	if (SDL_OpenAudio(&desired, NULL) < 0) {
+		fprintf(stderr, "Could not open audio: %s\n", SDL_GetError());
+		return 1;
+	}
+
+	audio.open = 1;
+	SDL_PauseAudio(0);
+
+	printf("Audio: %s, %d Hz, %d sample buffer (%.1f ms)\n",
+	       SDL_AudioDriverName(driver, sizeof(driver)) ? driver : "?",
+	       AUDIO_RATE, AUDIO_SAMPLES,
+	       AUDIO_SAMPLES * 1000.0 / AUDIO_RATE);
+
+	return 0;
+}
+
+void audio_play(enum sound sound)
+{
+	unsigned int head = audio.head;
+
+	if (!audio.open)
+		return;
+
+	/* Drop the effect rather than wait when the callback is behind. */
+	if (head - __atomic_load_n(&audio.tail, __ATOMIC_ACQUIRE)
+	    == AUDIO_QUEUE)
+		return;
+
+	audio.queue[head % AUDIO_QUEUE] = sound;
+	__atomic_store_n(&audio.head, head + 1, __ATOMIC_RELEASE);
+}
+
+void audio_free(void)
+{
+	int i;
+
+	if (audio.open)
+		SDL_CloseAudio();
+	audio.open = 0;
+
+	for (i = 0; i < NR_SOUNDS; i++)
+		free(audio.samples[i].data);
+}
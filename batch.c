@@ -0,0 +1,402 @@
+#include <string.h>
+
+#include "batch.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#define BATCH_X86
+#endif
+
+/*
+ * The batch simulation from batch.h.
+ *
+ * Boards are grouped BATCH_LANES at a time.  A group stores each row as
+ * a vector with one 16 bit lane per board, so a rotate is a shift and an
+ * or, an invert is an xor, and every board of the group takes the same
+ * path: per board moves become lane masks instead of branches.
+ *
+ * Clears follow figure_out_completed_space(): a block is nine cells of
+ * one colour, and where blocks overlap the one the game would find first
+ * (leftmost centre, then topmost) wins.  Finding candidates is cheap
+ * and done for all blocks at once; only the positions some lane has a
+ * candidate at are then checked in the game's order.
+ */
+
+typedef uint16_t vec __attribute__((vector_size(BATCH_LANES * 2)));
+
+struct group {
+	vec occupied[BATCH_HEIGHT];
+	vec white[BATCH_HEIGHT];
+	vec new_row;			/* white cells of the next row */
+	uint32_t rng[BATCH_LANES];
+};
+
+struct batch {
+	int nr_boards;
+	int nr_groups;
+	int cols;
+	int rows;
+	int rise_every;
+	int steps;
+	uint16_t mask;
+	struct group *groups;
+};
+
+#define GROUP_ALIGN 64
+
+typedef void (*step_fn)(struct batch *b, struct group *g, const vec *moves,
+			vec *clears, vec *topped, int rise);
+
+static step_fn step_group;
+
+/*
+ * Vectors go in and out of functions only through pointers, never by
+ * value, so no call depends on whether AVX is enabled; the helpers are
+ * always inlined so that the AVX2 step gets AVX2 code for them too.
+ */
+
+/* Every lane x. */
+#define SPLAT(x) ((vec) { 0 } + (uint16_t) (x))
+
+static inline __attribute__((always_inline))
+uint64_t fold(const vec *v)
+{
+	union {
+		vec v;
+		uint64_t q[sizeof(vec) / 8];
+	} u = { *v };
+	uint64_t x = 0;
+	unsigned i;
+
+	for (i = 0; i < sizeof(vec) / 8; i++)
+		x |= u.q[i];
+
+	return x;
+}
+
+/* Every column bit set in any lane. */
+static inline __attribute__((always_inline))
+uint16_t any_lane(const vec *v)
+{
+	uint64_t x = fold(v);
+
+	x |= x >> 32;
+	x |= x >> 16;
+
+	return x;
+}
+
+/* Leaves runs of three cells: bit i stays set if cells i to i + 2 are. */
+static inline __attribute__((always_inline))
+void triples(vec *v)
+{
+	*v &= *v >> 1 & *v >> 2;
+}
+
+/* Sets bit i of each lane of found if a block is centred on i, j. */
+static inline __attribute__((always_inline))
+void block(vec *found, const vec *occupied, const vec *white, int j)
+{
+	vec w[3], b[3];
+	int k;
+
+	for (k = 0; k < 3; k++) {
+		w[k] = occupied[j - 1 + k] & white[j - 1 + k];
+		triples(&w[k]);
+		b[k] = occupied[j - 1 + k] & ~white[j - 1 + k];
+		triples(&b[k]);
+	}
+
+	*found = (w[0] & w[1] & w[2]) | (b[0] & b[1] & b[2]);
+}
+
+static inline __attribute__((always_inline))
+void apply_moves(struct batch *b, struct group *g, const vec *move)
+{
+	vec sel, flip = { 0 }, o, w, mask = SPLAT(b->mask);
+	vec code = SPLAT(0), bit = SPLAT(1);
+	int j, i;
+
+	for (j = 0; j < BATCH_HEIGHT; j++, code += 1) {
+		sel = (vec) (*move == code);
+		o = g->occupied[j];
+		w = g->white[j];
+		g->occupied[j] ^= sel & (o ^ ((o << 1 | o >> (b->cols - 1))
+					      & mask));
+		g->white[j] ^= sel & (w ^ ((w << 1 | w >> (b->cols - 1))
+					   & mask));
+	}
+
+	/* code is now BATCH_INVERT(0). */
+	for (i = 0; i < b->cols; i++, code += 1, bit <<= 1)
+		flip |= (vec) (*move == code) & bit;
+
+	for (j = 0; j < BATCH_HEIGHT; j++)
+		g->white[j] ^= flip & g->occupied[j];
+}
+
+/* Drops every piece onto whatever is below it. */
+static inline __attribute__((always_inline))
+void gravity(struct group *g)
+{
+	vec holes = { 0 }, fall;
+	int j;
+
+	for (j = 0; j < BATCH_HEIGHT - 1; j++)
+		holes |= g->occupied[j] & ~g->occupied[j + 1];
+
+	/* Each pass moves everything with a hole below down a row. */
+	while (fold(&holes)) {
+		holes = (vec) { 0 };
+		for (j = BATCH_HEIGHT - 2; j >= 0; j--) {
+			fall = g->occupied[j] & ~g->occupied[j + 1];
+			g->occupied[j + 1] |= fall;
+			g->white[j + 1] |= g->white[j] & fall;
+			g->occupied[j] &= ~fall;
+			g->white[j] &= ~fall;
+			holes |= fall;
+		}
+	}
+}
+
+/* Clears blocks once; returns zero if there were none anywhere. */
+static inline __attribute__((always_inline))
+int clear_blocks(struct group *g, vec *clears)
+{
+	uint16_t where[BATCH_HEIGHT], found = 0;
+	vec w[BATCH_HEIGHT], b[BATCH_HEIGHT], hit, cells;
+	int i, j;
+
+	for (j = 0; j < BATCH_HEIGHT; j++) {
+		w[j] = g->occupied[j] & g->white[j];
+		triples(&w[j]);
+		b[j] = g->occupied[j] & ~g->white[j];
+		triples(&b[j]);
+	}
+
+	for (j = 1; j < BATCH_HEIGHT - 1; j++) {
+		hit = (w[j - 1] & w[j] & w[j + 1]) | (b[j - 1] & b[j] & b[j + 1]);
+		where[j] = any_lane(&hit);
+		found |= where[j];
+	}
+
+	if (!found)
+		return 0;
+
+	/* Clearing only removes blocks, so no new positions can appear. */
+	for (i = 0; i < BATCH_WIDTH - 2; i++) {
+		if (!(found >> i & 1))
+			continue;
+		for (j = 1; j < BATCH_HEIGHT - 1; j++) {
+			if (!(where[j] >> i & 1))
+				continue;
+
+			block(&hit, g->occupied, g->white, j);
+			hit = (vec) { 0 } - (hit >> i & 1);
+			cells = hit & SPLAT(7 << i);
+			g->occupied[j - 1] &= ~cells;
+			g->occupied[j] &= ~cells;
+			g->occupied[j + 1] &= ~cells;
+			g->white[j - 1] &= ~cells;
+			g->white[j] &= ~cells;
+			g->white[j + 1] &= ~cells;
+			*clears -= hit;
+		}
+	}
+
+	return 1;
+}
+
+static uint32_t next_random(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+static inline __attribute__((always_inline))
+void rise(struct batch *b, struct group *g, vec *topped)
+{
+	vec next = { 0 };
+	int j, k;
+
+	*topped |= (vec) (g->occupied[0] != SPLAT(0));
+
+	for (j = 0; j < BATCH_HEIGHT - 1; j++) {
+		g->occupied[j] = g->occupied[j + 1];
+		g->white[j] = g->white[j + 1];
+	}
+	g->occupied[BATCH_HEIGHT - 1] = SPLAT(b->mask);
+	g->white[BATCH_HEIGHT - 1] = g->new_row;
+
+	for (k = 0; k < BATCH_LANES; k++)
+		next[k] = next_random(&g->rng[k]) & b->mask;
+	g->new_row = next;
+}
+
+/*
+ * One step of a group, the way the game settles: gravity, then clears,
+ * until nothing falls or clears; then a new row if one is due.
+ */
+static inline __attribute__((always_inline))
+void step(struct batch *b, struct group *g, const vec *moves, vec *clears,
+	  vec *topped, int due)
+{
+	apply_moves(b, g, moves);
+
+	do
+		gravity(g);
+	while (clear_blocks(g, clears));
+
+	if (due)
+		rise(b, g, topped);
+}
+
+static void step_c(struct batch *b, struct group *g, const vec *moves,
+		   vec *clears, vec *topped, int due)
+{
+	step(b, g, moves, clears, topped, due);
+}
+
+#ifdef BATCH_X86
+__attribute__((target("avx2")))
+static void step_avx2(struct batch *b, struct group *g, const vec *moves,
+		      vec *clears, vec *topped, int due)
+{
+	step(b, g, moves, clears, topped, due);
+}
+#endif
+
+size_t batch_size(int nr_boards)
+{
+	int nr_groups = (nr_boards + BATCH_LANES - 1) / BATCH_LANES;
+
+	return sizeof(struct batch) + GROUP_ALIGN
+		+ nr_groups * sizeof(struct group);
+}
+
+static void reset(struct batch *b, struct group *g, int k)
+{
+	int j;
+
+	for (j = 0; j < BATCH_HEIGHT; j++) {
+		g->occupied[j][k] = 0;
+		g->white[j][k] = 0;
+	}
+
+	for (j = BATCH_HEIGHT - b->rows; j < BATCH_HEIGHT; j++) {
+		g->occupied[j][k] = b->mask;
+		g->white[j][k] = next_random(&g->rng[k]) & b->mask;
+	}
+
+	g->new_row[k] = next_random(&g->rng[k]) & b->mask;
+}
+
+struct batch *batch_init(void *memory, int nr_boards,
+			 const struct batch_config *config)
+{
+	struct batch *b = memory;
+	uintptr_t groups;
+	uint32_t seed;
+	int n, k;
+
+	if (nr_boards <= 0 || config->cols < 3 || config->cols > BATCH_WIDTH
+	    || config->rows < 1 || config->rows > BATCH_HEIGHT
+	    || config->rise_every < 0)
+		return NULL;
+
+	memset(b, 0, batch_size(nr_boards));
+	b->nr_boards = nr_boards;
+	b->nr_groups = (nr_boards + BATCH_LANES - 1) / BATCH_LANES;
+	b->cols = config->cols;
+	b->rows = config->rows;
+	b->rise_every = config->rise_every;
+	b->mask = (1 << config->cols) - 1;
+
+	groups = (uintptr_t) (b + 1);
+	groups = (groups + GROUP_ALIGN - 1) & ~(uintptr_t) (GROUP_ALIGN - 1);
+	b->groups = (struct group *) groups;
+
+	/* xorshift must not start at zero. */
+	seed = config->seed ? config->seed : 1;
+	for (n = 0; n < b->nr_groups * BATCH_LANES; n++) {
+		k = n % BATCH_LANES;
+		b->groups[n / BATCH_LANES].rng[k] = next_random(&seed);
+		reset(b, &b->groups[n / BATCH_LANES], k);
+	}
+
+	step_group = step_c;
+#ifdef BATCH_X86
+	if (__builtin_cpu_supports("avx2"))
+		step_group = step_avx2;
+#endif
+
+	return b;
+}
+
+void batch_step(struct batch *b, const uint8_t *moves, int32_t *rewards,
+		uint8_t *done)
+{
+	struct group *g;
+	vec move, clears, topped, empty;
+	int due, n, k, j;
+
+	due = b->rise_every && ++b->steps % b->rise_every == 0;
+
+	for (n = 0; n < b->nr_boards; n += BATCH_LANES) {
+		g = &b->groups[n / BATCH_LANES];
+
+		for (k = 0; k < BATCH_LANES; k++)
+			move[k] = n + k < b->nr_boards ? moves[n + k]
+						       : BATCH_WAIT;
+		clears = (vec) { 0 };
+		topped = (vec) { 0 };
+
+		step_group(b, g, &move, &clears, &topped, due);
+
+		empty = g->occupied[0];
+		for (j = 1; j < BATCH_HEIGHT; j++)
+			empty |= g->occupied[j];
+		topped |= (vec) (empty == SPLAT(0));
+
+		for (k = 0; k < BATCH_LANES && n + k < b->nr_boards; k++) {
+			rewards[n + k] = clears[k] * BATCH_CLEAR_REWARD;
+			done[n + k] = topped[k] != 0;
+			if (topped[k])
+				reset(b, g, k);
+		}
+	}
+}
+
+void batch_reset(struct batch *b, int board)
+{
+	reset(b, &b->groups[board / BATCH_LANES], board % BATCH_LANES);
+}
+
+void batch_get(const struct batch *b, int board,
+	       uint16_t occupied[BATCH_HEIGHT], uint16_t white[BATCH_HEIGHT])
+{
+	const struct group *g = &b->groups[board / BATCH_LANES];
+	int j, k = board % BATCH_LANES;
+
+	for (j = 0; j < BATCH_HEIGHT; j++) {
+		occupied[j] = g->occupied[j][k];
+		white[j] = g->white[j][k];
+	}
+}
+
+void batch_set(struct batch *b, int board,
+	       const uint16_t occupied[BATCH_HEIGHT],
+	       const uint16_t white[BATCH_HEIGHT])
+{
+	struct group *g = &b->groups[board / BATCH_LANES];
+	int j, k = board % BATCH_LANES;
+
+	for (j = 0; j < BATCH_HEIGHT; j++) {
+		g->occupied[j][k] = occupied[j] & b->mask;
+		g->white[j][k] = white[j] & occupied[j] & b->mask;
+	}
+}
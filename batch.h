@@ -0,0 +1,67 @@
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Batch simulation for training move policies.
+ *
+ * A batch holds any number of boards and steps all of them at once: one
+ * move per board, then gravity and clears resolved instantly, the way
+ * settled() would after every animation had finished, until the board
+ * is still.  Boards are kept bit-sliced, one 16 bit mask of occupied
+ * and one of white cells per row, with BATCH_LANES boards side by side
+ * in each vector, so the simulation runs on every board of a group in
+ * the same instructions.
+ *
+ * The caller owns all memory: batch_size() says how much a batch of n
+ * boards needs and nothing is allocated afterwards.  Row 0 is the top
+ * row and column i is bit i, as in the game.
+ */
+
+#define BATCH_LANES 16
+#define BATCH_WIDTH 10
+#define BATCH_HEIGHT 15
+
+/* A move: rotate a row to the right, or invert a column. */
+#define BATCH_ROTATE(row) (row)
+#define BATCH_INVERT(col) (BATCH_HEIGHT + (col))
+#define BATCH_WAIT 0xFF		/* any other value does nothing */
+
+#define BATCH_CLEAR_REWARD 100	/* per 3x3 block, as the score */
+
+struct batch;
+
+struct batch_config {
+	int cols;		/* 3 to BATCH_WIDTH */
+	int rows;		/* filled rows on a new board, at least 1 */
+	int rise_every;		/* steps between new rows, 0 for never */
+	uint32_t seed;
+};
+
+size_t batch_size(int nr_boards);
+
+/*
+ * Lays out a batch of nr_boards random boards in memory, which must hold
+ * batch_size(nr_boards) bytes.  Returns NULL if the config is invalid.
+ */
+struct batch *batch_init(void *memory, int nr_boards,
+			 const struct batch_config *config);
+
+/*
+ * Applies moves[n] to board n and resolves the result.  rewards[n] gets
+ * the points scored and done[n] is set if the board was topped out by a
+ * new row or emptied; such a board starts over before the next step.
+ */
+void batch_step(struct batch *b, const uint8_t *moves, int32_t *rewards,
+		uint8_t *done);
+
+void batch_reset(struct batch *b, int board);
+void batch_get(const struct batch *b, int board,
+	       uint16_t occupied[BATCH_HEIGHT], uint16_t white[BATCH_HEIGHT]);
+void batch_set(struct batch *b, int board,
+	       const uint16_t occupied[BATCH_HEIGHT],
+	       const uint16_t white[BATCH_HEIGHT]);
+
+#endif
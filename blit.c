@@ -0,0 +1,618 @@
+#include "game.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define BLIT_X86
+#endif
+
+/*
+ * Sprite blitter.
+ *
+ * load_image() looks at a sprite's alpha channel once and files it as
+ * opaque, binary (every pixel either opaque or clear) or translucent.
+ * blit_sprite() clips by hand and runs one row kernel per class: opaque
+ * rows are copied, binary rows select source or destination per pixel
+ * and translucent rows are blended.  The kernels are picked at startup
+ * for the CPU.
+ *
+ * On a 32 bit screen sprites stay ARGB8888.  On a 16 bit screen
+ * blit_convert() turns opaque and binary sprites into RGB565, binary ones
+ * marking clear pixels with a colour key, while translucent sprites stay
+ * ARGB8888 and are blended into the RGB565 screen.  On an 8 bit screen
+ * every sprite becomes palette indices into the fixed palette that
+ * blit_set_palette() installs; there is no blending there, so
+ * translucent pixels are thresholded to opaque or clear.  Any other
+ * pairing of sprite and screen is left to SDL_BlitSurface().
+ *
+ * Blending computes d + (s - d) * a / 255, rounded, on every channel;
+ * all kernels give the same result to the bit.
+ */
+
+#define AMASK 0xFF000000u
+
+#define RMASK16 0xF800
+#define GMASK16 0x07E0
+#define BMASK16 0x001F
+#define KEY16 0xF81F		/* magenta, marks clear pixels */
+
+/*
+ * The 8 bit palette: a 6x6x6 colour cube, 39 greys in between the
+ * cube's own, and the colour key.
+ */
+#define CUBE_COLOURS 216
+#define NR_GREYS 39
+#define KEY8 255
+
+typedef void (*blit_row_fn)(void *dst, const void *src, int w);
+
+/* Indexed by the destination's bytes per pixel, then sprite kind. */
+static blit_row_fn kernels[5][NR_SPRITE_KINDS];
+
+static void copy_row32(void *dst, const void *src, int w)
+{
+	memcpy(dst, src, w * 4);
+}
+
+static void copy_row16(void *dst, const void *src, int w)
+{
+	memcpy(dst, src, w * 2);
+}
+
+static void copy_row8(void *dst, const void *src, int w)
+{
+	memcpy(dst, src, w);
+}
+
+static void select_row_c(void *d, const void *s, int w)
+{
+	Uint32 *dst = d;
+	const Uint32 *src = s;
+	int x;
+
+	for (x = 0; x < w; x++)
+		if (src[x] & AMASK)
+			dst[x] = src[x];
+}
+
+static void blend_row_c(void *dp, const void *sp, int w)
+{
+	Uint32 *dst = dp;
+	const Uint32 *src = sp;
+	Uint32 s, d, a, c, out;
+	int x, i;
+
+	for (x = 0; x < w; x++) {
+		s = src[x];
+		d = dst[x];
+		a = s >> 24;
+
+		out = 0;
+		for (i = 0; i < 32; i += 8) {
+			c = ((s >> i) & 0xFF) * a
+				+ ((d >> i) & 0xFF) * (255 - a) + 128;
+			out |= ((c + (c >> 8)) >> 8) << i;
+		}
+		dst[x] = out;
+	}
+}
+
+static void select_row16_c(void *d, const void *s, int w)
+{
+	Uint16 *dst = d;
+	const Uint16 *src = s;
+	int x;
+
+	for (x = 0; x < w; x++)
+		if (src[x] != KEY16)
+			dst[x] = src[x];
+}
+
+static void select_row8_c(void *d, const void *s, int w)
+{
+	Uint8 *dst = d;
+	const Uint8 *src = s;
+	int x;
+
+	for (x = 0; x < w; x++)
+		if (src[x] != KEY8)
+			dst[x] = src[x];
+}
+
+/* The nearest RGB565 value to an 8 bit a channel colour. */
+static inline Uint16 pack565(Uint32 r, Uint32 g, Uint32 b)
+{
+	return (r * 31 + 127) / 255 << 11 | (g * 63 + 127) / 255 << 5
+		| (b * 31 + 127) / 255;
+}
+
+/* Blends ARGB8888 onto RGB565, as blend_row_c on the widened screen. */
+static void blend_row16_c(void *dp, const void *sp, int w)
+{
+	Uint16 *dst = dp;
+	const Uint32 *src = sp;
+	Uint32 s, d, a, c, out[3];
+	int x, i;
+
+	for (x = 0; x < w; x++) {
+		s = src[x];
+		a = s >> 24;
+		if (a == 0)
+			continue;
+
+		d = dst[x];
+		d = ((d >> 11) << 3 | (d >> 13)) << 16
+			| ((d >> 5 & 0x3F) << 2 | (d >> 9 & 3)) << 8
+			| (d & 0x1F) << 3 | (d >> 2 & 7);
+
+		for (i = 0; i < 3; i++) {
+			c = ((s >> i * 8) & 0xFF) * a
+				+ ((d >> i * 8) & 0xFF) * (255 - a) + 128;
+			out[i] = (c + (c >> 8)) >> 8;
+		}
+		dst[x] = pack565(out[2], out[1], out[0]);
+	}
+}
+
+#ifdef BLIT_X86
+__attribute__((target("sse2")))
+static void select_row_sse2(void *dp, const void *sp, int w)
+{
+	Uint32 *dst = dp;
+	const Uint32 *src = sp;
+	const __m128i amask = _mm_set1_epi32(AMASK);
+	__m128i s, d, clear;
+	int x;
+
+	for (x = 0; x + 4 <= w; x += 4) {
+		s = _mm_loadu_si128((const __m128i *) (src + x));
+		d = _mm_loadu_si128((const __m128i *) (dst + x));
+		clear = _mm_cmpeq_epi32(_mm_and_si128(s, amask),
+					_mm_setzero_si128());
+		d = _mm_or_si128(_mm_andnot_si128(clear, s),
+				 _mm_and_si128(clear, d));
+		_mm_storeu_si128((__m128i *) (dst + x), d);
+	}
+
+	select_row_c(dst + x, src + x, w - x);
+}
+
+/* Blends two pixels widened to 16 bits a channel, as in blend_row_c. */
+__attribute__((target("sse2")))
+static inline __m128i blend_sse2(__m128i s, __m128i d)
+{
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+	__m128i c;
+
+	c = _mm_add_epi16(_mm_mullo_epi16(s, a),
+			  _mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255),
+							   a)));
+	c = _mm_add_epi16(c, _mm_set1_epi16(128));
+
+	return _mm_srli_epi16(_mm_add_epi16(c, _mm_srli_epi16(c, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void blend_row_sse2(void *dp, const void *sp, int w)
+{
+	Uint32 *dst = dp;
+	const Uint32 *src = sp;
+	const __m128i zero = _mm_setzero_si128();
+	__m128i s, d, lo, hi;
+	int x;
+
+	for (x = 0; x + 4 <= w; x += 4) {
+		s = _mm_loadu_si128((const __m128i *) (src + x));
+		d = _mm_loadu_si128((const __m128i *) (dst + x));
+		lo = blend_sse2(_mm_unpacklo_epi8(s, zero),
+				_mm_unpacklo_epi8(d, zero));
+		hi = blend_sse2(_mm_unpackhi_epi8(s, zero),
+				_mm_unpackhi_epi8(d, zero));
+		_mm_storeu_si128((__m128i *) (dst + x),
+				 _mm_packus_epi16(lo, hi));
+	}
+
+	blend_row_c(dst + x, src + x, w - x);
+}
+
+__attribute__((target("sse2")))
+static void select_row16_sse2(void *dp, const void *sp, int w)
+{
+	Uint16 *dst = dp;
+	const Uint16 *src = sp;
+	const __m128i key = _mm_set1_epi16((short) KEY16);
+	__m128i s, d, clear;
+	int x;
+
+	for (x = 0; x + 8 <= w; x += 8) {
+		s = _mm_loadu_si128((const __m128i *) (src + x));
+		d = _mm_loadu_si128((const __m128i *) (dst + x));
+		clear = _mm_cmpeq_epi16(s, key);
+		d = _mm_or_si128(_mm_andnot_si128(clear, s),
+				 _mm_and_si128(clear, d));
+		_mm_storeu_si128((__m128i *) (dst + x), d);
+	}
+
+	select_row16_c(dst + x, src + x, w - x);
+}
+
+__attribute__((target("sse2")))
+static void select_row8_sse2(void *dp, const void *sp, int w)
+{
+	Uint8 *dst = dp;
+	const Uint8 *src = sp;
+	const __m128i key = _mm_set1_epi8((char) KEY8);
+	__m128i s, d, clear;
+	int x;
+
+	for (x = 0; x + 16 <= w; x += 16) {
+		s = _mm_loadu_si128((const __m128i *) (src + x));
+		d = _mm_loadu_si128((const __m128i *) (dst + x));
+		clear = _mm_cmpeq_epi8(s, key);
+		d = _mm_or_si128(_mm_andnot_si128(clear, s),
+				 _mm_and_si128(clear, d));
+		_mm_storeu_si128((__m128i *) (dst + x), d);
+	}
+
+	select_row8_c(dst + x, src + x, w - x);
+}
+
+__attribute__((target("avx2")))
+static void select_row_avx2(void *dp, const void *sp, int w)
+{
+	Uint32 *dst = dp;
+	const Uint32 *src = sp;
+	const __m256i amask = _mm256_set1_epi32(AMASK);
+	__m256i s, d, clear;
+	int x;
+
+	for (x = 0; x + 8 <= w; x += 8) {
+		s = _mm256_loadu_si256((const __m256i *) (src + x));
+		d = _mm256_loadu_si256((const __m256i *) (dst + x));
+		clear = _mm256_cmpeq_epi32(_mm256_and_si256(s, amask),
+					   _mm256_setzero_si256());
+		_mm256_storeu_si256((__m256i *) (dst + x),
+				    _mm256_blendv_epi8(s, d, clear));
+	}
+
+	select_row_c(dst + x, src + x, w - x);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend_avx2(__m256i s, __m256i d)
+{
+	__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xFF),
+					   0xFF);
+	__m256i c;
+
+	c = _mm256_add_epi16(_mm256_mullo_epi16(s, a),
+			     _mm256_mullo_epi16(d, _mm256_sub_epi16(
+					     _mm256_set1_epi16(255), a)));
+	c = _mm256_add_epi16(c, _mm256_set1_epi16(128));
+
+	return _mm256_srli_epi16(_mm256_add_epi16(c, _mm256_srli_epi16(c, 8)),
+				 8);
+}
+
+__attribute__((target("avx2")))
+static void blend_row_avx2(void *dp, const void *sp, int w)
+{
+	Uint32 *dst = dp;
+	const Uint32 *src = sp;
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i s, d, lo, hi;
+	int x;
+
+	/* Unpack and pack both work within 128 bit lanes, so they cancel. */
+	for (x = 0; x + 8 <= w; x += 8) {
+		s = _mm256_loadu_si256((const __m256i *) (src + x));
+		d = _mm256_loadu_si256((const __m256i *) (dst + x));
+		lo = blend_avx2(_mm256_unpacklo_epi8(s, zero),
+				_mm256_unpacklo_epi8(d, zero));
+		hi = blend_avx2(_mm256_unpackhi_epi8(s, zero),
+				_mm256_unpackhi_epi8(d, zero));
+		_mm256_storeu_si256((__m256i *) (dst + x),
+				    _mm256_packus_epi16(lo, hi));
+	}
+
+	blend_row_c(dst + x, src + x, w - x);
+}
+#endif
+
+void blit_init(void)
+{
+	kernels[4][SPRITE_OPAQUE] = copy_row32;
+	kernels[4][SPRITE_BINARY] = select_row_c;
+	kernels[4][SPRITE_TRANSLUCENT] = blend_row_c;
+
+	kernels[2][SPRITE_OPAQUE] = copy_row16;
+	kernels[2][SPRITE_BINARY] = select_row16_c;
+	kernels[2][SPRITE_TRANSLUCENT] = blend_row16_c;
+
+	/* Translucent sprites are made binary on 8 bit screens. */
+	kernels[1][SPRITE_OPAQUE] = copy_row8;
+	kernels[1][SPRITE_BINARY] = select_row8_c;
+
+#ifdef BLIT_X86
+	if (__builtin_cpu_supports("sse2")) {
+		kernels[4][SPRITE_BINARY] = select_row_sse2;
+		kernels[4][SPRITE_TRANSLUCENT] = blend_row_sse2;
+		kernels[2][SPRITE_BINARY] = select_row16_sse2;
+		kernels[1][SPRITE_BINARY] = select_row8_sse2;
+	}
+
+	if (__builtin_cpu_supports("avx2")) {
+		kernels[4][SPRITE_BINARY] = select_row_avx2;
+		kernels[4][SPRITE_TRANSLUCENT] = blend_row_avx2;
+	}
+#endif
+}
+
+/* 32 bit surfaces the kernels can read and write directly. */
+static int blit_format(const SDL_PixelFormat *fmt)
+{
+	return fmt->BytesPerPixel == 4 && (fmt->Amask == 0 || fmt->Amask == AMASK);
+}
+
+static int is_565(const SDL_PixelFormat *fmt)
+{
+	return fmt->BytesPerPixel == 2 && fmt->Rmask == RMASK16
+		&& fmt->Gmask == GMASK16 && fmt->Bmask == BMASK16;
+}
+
+/* Whether a sprite in format src can be drawn onto dst by a kernel. */
+static int blit_compatible(const SDL_PixelFormat *src,
+			   const SDL_PixelFormat *dst, enum sprite_kind kind)
+{
+	switch (dst->BytesPerPixel) {
+	case 4:
+		return blit_format(src) && blit_format(dst)
+			&& src->Rmask == dst->Rmask
+			&& src->Gmask == dst->Gmask
+			&& src->Bmask == dst->Bmask;
+	case 2:
+		if (!is_565(dst))
+			return 0;
+		if (kind == SPRITE_TRANSLUCENT)
+			return src->BytesPerPixel == 4 && src->Amask == AMASK
+				&& src->Rmask == 0xFF0000 && src->Bmask == 0xFF;
+		return is_565(src);
+	case 1:
+		return src->BytesPerPixel == 1 && kind != SPRITE_TRANSLUCENT;
+	default:
+		return 0;
+	}
+}
+
+enum sprite_kind blit_classify(SDL_Surface *surface)
+{
+	enum sprite_kind kind = SPRITE_OPAQUE;
+	const Uint32 *row;
+	Uint32 a;
+	int x, y;
+
+	if (surface->format->Amask == 0)
+		return SPRITE_OPAQUE;
+
+	if (!blit_format(surface->format))
+		return SPRITE_TRANSLUCENT;
+
+	if (SDL_MUSTLOCK(surface) && SDL_LockSurface(surface) < 0)
+		return SPRITE_TRANSLUCENT;
+
+	for (y = 0; y < surface->h && kind != SPRITE_TRANSLUCENT; y++) {
+		row = (const Uint32 *) ((Uint8 *) surface->pixels
+					+ y * surface->pitch);
+		for (x = 0; x < surface->w; x++) {
+			a = row[x] & AMASK;
+			if (a == 0)
+				kind = SPRITE_BINARY;
+			else if (a != AMASK) {
+				kind = SPRITE_TRANSLUCENT;
+				break;
+			}
+		}
+	}
+
+	if (SDL_MUSTLOCK(surface))
+		SDL_UnlockSurface(surface);
+
+	return kind;
+}
+
+static Uint8 grey_level(int i)
+{
+	return (i + 1) * 255 / (NR_GREYS + 1);
+}
+
+/* The palette index nearest to r, g, b, never the colour key. */
+static Uint8 map8(int r, int g, int b)
+{
+	int cr = (r + 25) / 51, cg = (g + 25) / 51, cb = (b + 25) / 51;
+	int y = (r + g + b) / 3, k, v, cube_err, grey_err;
+
+	cube_err = (r - cr * 51) * (r - cr * 51) + (g - cg * 51) * (g - cg * 51)
+		+ (b - cb * 51) * (b - cb * 51);
+
+	k = (y * (NR_GREYS + 1) + 127) / 255 - 1;
+	if (k < 0)
+		k = 0;
+	if (k >= NR_GREYS)
+		k = NR_GREYS - 1;
+	v = grey_level(k);
+	grey_err = (r - v) * (r - v) + (g - v) * (g - v) + (b - v) * (b - v);
+
+	if (grey_err < cube_err)
+		return CUBE_COLOURS + k;
+
+	return cr * 36 + cg * 6 + cb;
+}
+
+/* Installs the palette 8 bit sprites are converted against. */
+void blit_set_palette(SDL_Surface *screen)
+{
+	SDL_Color colours[256];
+	int i;
+
+	for (i = 0; i < CUBE_COLOURS; i++) {
+		colours[i].r = i / 36 * 51;
+		colours[i].g = i / 6 % 6 * 51;
+		colours[i].b = i % 6 * 51;
+	}
+	for (i = 0; i < NR_GREYS; i++) {
+		colours[CUBE_COLOURS + i].r = grey_level(i);
+		colours[CUBE_COLOURS + i].g = grey_level(i);
+		colours[CUBE_COLOURS + i].b = grey_level(i);
+	}
+	colours[KEY8].r = 255;
+	colours[KEY8].g = 0;
+	colours[KEY8].b = 255;
+
+	SDL_SetColors(screen, colours, 0, 256);
+}
+
+/*
+ * Converts a loaded ARGB8888 sprite to suit a screen of the given format,
+ * as described at the top.  Leaves the sprite alone if it cannot.
+ */
+void blit_convert(struct sprite *sprite, const SDL_PixelFormat *screen)
+{
+	SDL_Surface *src = sprite->surface, *out;
+	enum sprite_kind kind = sprite->kind;
+	const Uint32 *in;
+	Uint32 p, a;
+	Uint8 *row;
+	int bpp = screen->BytesPerPixel;
+	int x, y;
+
+	if (bpp == 4 || !blit_format(src->format) || src->format->Amask == 0
+	    || SDL_MUSTLOCK(src))
+		return;
+	if (bpp == 2 && (!is_565(screen) || kind == SPRITE_TRANSLUCENT))
+		return;
+	if (bpp != 2 && bpp != 1)
+		return;
+
+	if (bpp == 2)
+		out = SDL_CreateRGBSurface(SDL_SWSURFACE, src->w, src->h, 16,
+					   RMASK16, GMASK16, BMASK16, 0);
+	else
+		out = SDL_CreateRGBSurface(SDL_SWSURFACE, src->w, src->h, 8,
+					   0, 0, 0, 0);
+	if (out == NULL)
+		return;
+	if (bpp == 1 && screen->palette)
+		SDL_SetColors(out, screen->palette->colors, 0,
+			      screen->palette->ncolors);
+
+	if (kind == SPRITE_TRANSLUCENT)
+		kind = SPRITE_BINARY;
+
+	for (y = 0; y < src->h; y++) {
+		in = (const Uint32 *) ((Uint8 *) src->pixels + y * src->pitch);
+		row = (Uint8 *) out->pixels + y * out->pitch;
+
+		for (x = 0; x < src->w; x++) {
+			p = in[x];
+			a = p >> 24;
+
+			if (bpp == 2) {
+				Uint16 v = pack565(p >> 16 & 0xFF,
+						   p >> 8 & 0xFF, p & 0xFF);
+
+				if (kind == SPRITE_BINARY)
+					v = a == 0 ? KEY16
+						: v == KEY16 ? KEY16 ^ 1 : v;
+				((Uint16 *) row)[x] = v;
+			} else {
+				row[x] = a < 128 && kind == SPRITE_BINARY
+					? KEY8 : map8(p >> 16 & 0xFF,
+						      p >> 8 & 0xFF, p & 0xFF);
+			}
+		}
+	}
+
+	if (kind == SPRITE_BINARY)
+		SDL_SetColorKey(out, SDL_SRCCOLORKEY, bpp == 2 ? KEY16 : KEY8);
+
+	SDL_FreeSurface(src);
+	sprite->surface = out;
+	sprite->kind = kind;
+}
+
+/*
+ * Draws the clip part of sprite (all of it if clip is NULL) at x, y.
+ * Returns 1, having drawn nothing, if the caller has to use
+ * SDL_BlitSurface() instead.
+ */
+int blit_sprite(int x, int y, const struct sprite *sprite,
+		SDL_Surface *destination, const SDL_Rect *clip)
+{
+	SDL_Surface *src = sprite->surface;
+	const SDL_Rect *bounds = &destination->clip_rect;
+	int bpp = destination->format->BytesPerPixel;
+	blit_row_fn row = bpp <= 4 ? kernels[bpp][sprite->kind] : NULL;
+	int sx = 0, sy = 0, w = src->w, h = src->h;
+	Uint8 *s, *d;
+	int j;
+
+	if (row == NULL || SDL_MUSTLOCK(src)
+	    || !blit_compatible(src->format, destination->format,
+				sprite->kind))
+		return 1;
+
+	if (clip) {
+		sx = clip->x;
+		sy = clip->y;
+		w = clip->w;
+		h = clip->h;
+		if (sx < 0) {
+			w += sx;
+			x -= sx;
+			sx = 0;
+		}
+		if (sy < 0) {
+			h += sy;
+			y -= sy;
+			sy = 0;
+		}
+		if (sx + w > src->w)
+			w = src->w - sx;
+		if (sy + h > src->h)
+			h = src->h - sy;
+	}
+
+	if (x < bounds->x) {
+		sx += bounds->x - x;
+		w -= bounds->x - x;
+		x = bounds->x;
+	}
+	if (y < bounds->y) {
+		sy += bounds->y - y;
+		h -= bounds->y - y;
+		y = bounds->y;
+	}
+	if (x + w > bounds->x + bounds->w)
+		w = bounds->x + bounds->w - x;
+	if (y + h > bounds->y + bounds->h)
+		h = bounds->y + bounds->h - y;
+
+	if (w <= 0 || h <= 0)
+		return 0;
+
+	if (SDL_MUSTLOCK(destination) && SDL_LockSurface(destination) < 0)
+		return 1;
+
+	s = (Uint8 *) src->pixels + sy * src->pitch
+		+ sx * src->format->BytesPerPixel;
+	d = (Uint8 *) destination->pixels + y * destination->pitch + x * bpp;
+	for (j = 0; j < h; j++) {
+		row(d, s, w);
+		s += src->pitch;
+		d += destination->pitch;
+	}
+
+	if (SDL_MUSTLOCK(destination))
+		SDL_UnlockSurface(destination);
+
+	return 0;
+}
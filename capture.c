@@ -0,0 +1,262 @@
+#include "game.h"
+
+/*
+ * Gameplay capture.
+ *
+ * The game thread copies the rows that changed since the last captured
+ * frame into a free slot of a preallocated ring and hands it to an
+ * encoder thread, which rebuilds the full frame and appends it to a raw
+ * video file.  The game thread never waits on the encoder: when the ring
+ * is full the frame is dropped and counted.
+ *
+ * Frames are written in the screen's pixel format, except that palette
+ * indices from an 8 bit screen are expanded to 32 bit XRGB words, as a
+ * raw file has nowhere to keep the palette.
+ */
+
+#define CAPTURE_SLOTS 8
+#define CAPTURE_FPS 30
+
+struct capture_slot {
+	Uint8 *rows;
+	Uint8 *pixels;
+};
+
+static struct {
+	FILE *out;
+	SDL_Thread *thread;
+	SDL_sem *ready;
+	int quit;
+
+	int w, h, row_bytes;
+	int out_bpp;		/* bytes per pixel written */
+	int expand;		/* 8 bit screen: write palette[index] */
+	Uint32 palette[256];
+	struct damage damage;
+	struct capture_slot slots[CAPTURE_SLOTS];
+	unsigned int head;	/* written by the game thread */
+	unsigned int tail;	/* written by the encoder thread */
+
+	Uint8 *frame;		/* encoder's copy of the full frame */
+	Uint32 next_tick;
+
+	unsigned int captured;
+	unsigned int dropped;
+	unsigned int written;
+} capture;
+
+static void expand_row(Uint32 *dst, const Uint8 *src, int w)
+{
+	int x;
+
+	for (x = 0; x < w; x++)
+		dst[x] = capture.palette[src[x]];
+}
+
+static void encode_slot(struct capture_slot *slot)
+{
+	int out_row = capture.w * capture.out_bpp;
+	int y;
+
+	for (y = 0; y < capture.h; y++) {
+		if (!slot->rows[y])
+			continue;
+		if (capture.expand)
+			expand_row((Uint32 *) (capture.frame + y * out_row),
+				   slot->pixels + y * capture.row_bytes,
+				   capture.w);
+		else
+			memcpy(capture.frame + y * out_row,
+			       slot->pixels + y * capture.row_bytes,
+			       capture.row_bytes);
+	}
+
+	if (fwrite(capture.frame, out_row * capture.h, 1, capture.out) == 1)
+		capture.written++;
+}
+
+static int encoder_thread(void *data)
+{
+	unsigned int tail;
+
+	(void) data;
+
+	flight_thread("capture");
+
+	for (;;) {
+		SDL_SemWait(capture.ready);
+
+		tail = capture.tail;
+		if (tail == __atomic_load_n(&capture.head, __ATOMIC_ACQUIRE)) {
+			if (__atomic_load_n(&capture.quit, __ATOMIC_ACQUIRE))
+				break;
+			continue;
+		}
+
+		encode_slot(&capture.slots[tail % CAPTURE_SLOTS]);
+
+		__atomic_store_n(&capture.tail, tail + 1, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+static void free_buffers(void)
+{
+	int i;
+
+	for (i = 0; i < CAPTURE_SLOTS; i++) {
+		free(capture.slots[i].rows);
+		free(capture.slots[i].pixels);
+		capture.slots[i].rows = NULL;
+		capture.slots[i].pixels = NULL;
+	}
+	free(capture.frame);
+	capture.frame = NULL;
+	damage_free(&capture.damage);
+}
+
+int capture_start(const char *filename, SDL_Surface *screen)
+{
+	SDL_Color *colours;
+	int i;
+	int failed;
+	int bpp = screen->format->BytesPerPixel;
+
+	memset(&capture, 0, sizeof(capture));
+
+	capture.w = screen->w;
+	capture.h = screen->h;
+	capture.row_bytes = screen->w * bpp;
+	capture.out_bpp = bpp;
+
+	/* The palette is fixed once set, so one copy covers the capture. */
+	if (bpp == 1 && screen->format->palette) {
+		colours = screen->format->palette->colors;
+		for (i = 0; i < screen->format->palette->ncolors; i++)
+			capture.palette[i] = colours[i].r << 16
+				| colours[i].g << 8 | colours[i].b;
+		capture.out_bpp = 4;
+		capture.expand = 1;
+	}
+
+	if (damage_init(&capture.damage, screen->w, screen->h, bpp) != 0) {
+		fprintf(stderr, "Could not allocate capture buffers.\n");
+		return 1;
+	}
+
+	capture.frame = calloc(capture.h, capture.w * capture.out_bpp);
+	failed = capture.frame == NULL;
+	for (i = 0; i < CAPTURE_SLOTS; i++) {
+		capture.slots[i].rows = malloc(capture.h);
+		capture.slots[i].pixels = malloc(capture.h * capture.row_bytes);
+		if (!capture.slots[i].rows || !capture.slots[i].pixels)
+			failed = 1;
+	}
+
+	if (failed) {
+		fprintf(stderr, "Could not allocate capture buffers.\n");
+		free_buffers();
+		return 1;
+	}
+
+	capture.out = fopen(filename, "wb");
+	if (capture.out == NULL) {
+		fprintf(stderr, "Could not open %s: %s\n",
+			filename, strerror(errno));
+		free_buffers();
+		return 1;
+	}
+
+	capture.ready = SDL_CreateSemaphore(0);
+	if (capture.ready)
+		capture.thread = SDL_CreateThread(encoder_thread, NULL);
+	if (capture.thread == NULL) {
+		fprintf(stderr, "Could not start capture thread: %s\n",
+			SDL_GetError());
+		if (capture.ready)
+			SDL_DestroySemaphore(capture.ready);
+		fclose(capture.out);
+		capture.out = NULL;
+		free_buffers();
+		return 1;
+	}
+
+	capture.next_tick = SDL_GetTicks();
+
+	printf("Capturing %dx%d %d bpp raw frames at %d fps to %s\n",
+	       capture.w, capture.h,
+	       capture.expand ? 32 : screen->format->BitsPerPixel,
+	       CAPTURE_FPS, filename);
+
+	return 0;
+}
+
+void capture_frame(SDL_Surface *screen)
+{
+	struct capture_slot *slot;
+	unsigned int head;
+	Uint32 now;
+	int y;
+
+	if (capture.out == NULL)
+		return;
+
+	now = SDL_GetTicks();
+	if ((Sint32) (now - capture.next_tick) < 0)
+		return;
+
+	capture.next_tick += 1000 / CAPTURE_FPS;
+	if ((Sint32) (now - capture.next_tick) > 1000)
+		capture.next_tick = now;
+
+	head = capture.head;
+	if (head - __atomic_load_n(&capture.tail, __ATOMIC_ACQUIRE)
+	    == CAPTURE_SLOTS) {
+		capture.dropped++;
+		return;
+	}
+
+	slot = &capture.slots[head % CAPTURE_SLOTS];
+
+	if (SDL_MUSTLOCK(screen))
+		SDL_LockSurface(screen);
+
+	damage_update(&capture.damage, screen);
+
+	for (y = 0; y < capture.h; y++) {
+		slot->rows[y] = capture.damage.rows[y];
+		if (!slot->rows[y])
+			continue;
+		memcpy(slot->pixels + y * capture.row_bytes,
+		       (Uint8 *) screen->pixels + y * screen->pitch,
+		       capture.row_bytes);
+	}
+
+	if (SDL_MUSTLOCK(screen))
+		SDL_UnlockSurface(screen);
+
+	capture.captured++;
+
+	__atomic_store_n(&capture.head, head + 1, __ATOMIC_RELEASE);
+	SDL_SemPost(capture.ready);
+}
+
+void capture_stop(void)
+{
+	if (capture.out == NULL)
+		return;
+
+	__atomic_store_n(&capture.quit, 1, __ATOMIC_RELEASE);
+	SDL_SemPost(capture.ready);
+	SDL_WaitThread(capture.thread, NULL);
+	SDL_DestroySemaphore(capture.ready);
+
+	fclose(capture.out);
+	capture.out = NULL;
+
+	printf("Capture: %u frames written, %u dropped\n",
+	       capture.written, capture.dropped);
+
+	free_buffers();
+}
@@ -0,0 +1,58 @@
+#include "game.h"
+
+int damage_init(struct damage *d, int w, int h, int bytes_per_pixel)
+{
+	d->row_bytes = w * bytes_per_pixel;
+	d->h = h;
+	d->count = 0;
+	d->primed = 0;
+
+	d->shadow = malloc(d->row_bytes * h);
+	d->rows = malloc(h);
+
+	if (d->shadow == NULL || d->rows == NULL) {
+		damage_free(d);
+		return 1;
+	}
+
+	return 0;
+}
+
+void damage_free(struct damage *d)
+{
+	free(d->shadow);
+	free(d->rows);
+	d->shadow = NULL;
+	d->rows = NULL;
+}
+
+/*
+ * Marks every row of the surface that differs from the copy taken on the
+ * previous call and refreshes that copy.  The first call marks everything.
+ * The surface must already be locked.  Returns the number of dirty rows.
+ */
+int damage_update(struct damage *d, SDL_Surface *surface)
+{
+	int y;
+	Uint8 *src, *dst;
+
+	d->count = 0;
+
+	for (y = 0; y < d->h; y++) {
+		src = (Uint8 *) surface->pixels + y * surface->pitch;
+		dst = d->shadow + y * d->row_bytes;
+
+		if (d->primed && memcmp(src, dst, d->row_bytes) == 0) {
+			d->rows[y] = 0;
+			continue;
+		}
+
+		memcpy(dst, src, d->row_bytes);
+		d->rows[y] = 1;
+		d->count++;
+	}
+
+	d->primed = 1;
+
+	return d->count;
+}
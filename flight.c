@@ -0,0 +1,207 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "game.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define FLIGHT_TSC
+#endif
+
+/*
+ * Flight recorder; see flight.h for the file it writes.
+ *
+ * Rings are handed out to threads the first time they record and never
+ * given back.  A thread that finds them all taken records nothing.  The
+ * dump reads the rings while their threads may still be writing, so the
+ * newest record of a ring can be torn; the decoder only has to cope.
+ * Everything the dump does is safe in a signal handler, which runs on an
+ * alternate stack given to each thread along with its ring, so a stack
+ * overflow in any thread that has one still leaves room to dump.
+ */
+
+static struct flight_ring rings[FLIGHT_RINGS];
+static int nr_rings;
+
+static struct flight_header header;
+static const char *dump_path;
+static int dumping;
+
+static __thread struct flight_ring *ring;
+static __thread int no_ring;	/* all taken when this thread asked */
+
+#define ALT_STACK_SIZE 16384
+
+static inline Uint64 flight_ticks(void)
+{
+#ifdef FLIGHT_TSC
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (Uint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static Uint64 flight_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (Uint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Gives the calling thread a ring of its own under name, and a stack for
+ * the crash handler.  Every thread the game starts calls this first; the
+ * audio thread belongs to SDL and its callback must not make system
+ * calls, so it goes without.
+ */
+void flight_thread(const char *name)
+{
+	int i = __atomic_load_n(&nr_rings, __ATOMIC_RELAXED);
+	stack_t stack;
+
+	if (ring || no_ring)
+		return;
+
+	do {
+		if (i >= FLIGHT_RINGS) {
+			no_ring = 1;
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&nr_rings, &i, i + 1, 1,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	ring = &rings[i];
+	strncpy(ring->name, name, FLIGHT_NAME - 1);
+
+	/*
+	 * Mapped rather than cut from a static array, so that stacks can be
+	 * added without reserving them all up front; like the ring, it is
+	 * never given back.
+	 */
+	stack.ss_sp = mmap(NULL, ALT_STACK_SIZE, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	stack.ss_size = ALT_STACK_SIZE;
+	stack.ss_flags = 0;
+	if (stack.ss_sp != MAP_FAILED)
+		sigaltstack(&stack, NULL);
+}
+
+void flight_record(int type, int a, Uint32 b)
+{
+	struct flight_record *r;
+	Uint64 head;
+
+	if (ring == NULL) {
+		if (no_ring)
+			return;
+		flight_thread("thread");
+		if (ring == NULL)
+			return;
+	}
+
+	head = ring->head;
+	r = &ring->records[head & (FLIGHT_RECORDS - 1)];
+	r->time = flight_ticks();
+	r->type = type;
+	r->a = a;
+	r->b = b;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Records the load of asset name, which took us microseconds. */
+void flight_asset(const char *name, Uint32 us)
+{
+	const char *base = strrchr(name, '/');
+	int i = __atomic_fetch_add(&header.nr_assets, 1, __ATOMIC_RELAXED);
+
+	if (i >= FLIGHT_ASSETS) {
+		flight_record(FLIGHT_ASSET, FLIGHT_ASSETS, us);
+		return;
+	}
+
+	strncpy(header.assets[i], base ? base + 1 : name,
+		FLIGHT_ASSET_NAME - 1);
+	flight_record(FLIGHT_ASSET, i, us);
+}
+
+/* Writes the rings to the dump file; returns 1 if it could not. */
+int flight_dump(int signal)
+{
+	struct flight_header h;
+	int fd, n, ok;
+
+	if (dump_path == NULL || __atomic_exchange_n(&dumping, 1,
+						     __ATOMIC_ACQUIRE))
+		return 1;
+
+	h = header;
+	n = __atomic_load_n(&nr_rings, __ATOMIC_RELAXED);
+	h.nr_rings = n;
+	if (h.nr_assets > FLIGHT_ASSETS)
+		h.nr_assets = FLIGHT_ASSETS;
+	h.signal = signal;
+	h.dump_ticks = flight_ticks();
+	h.dump_ns = flight_ns();
+
+	fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ok = fd >= 0
+		&& write(fd, &h, sizeof(h)) == sizeof(h)
+		&& write(fd, rings, h.nr_rings * sizeof(rings[0]))
+		== (ssize_t) (h.nr_rings * sizeof(rings[0]));
+	if (fd >= 0)
+		close(fd);
+
+	__atomic_store_n(&dumping, 0, __ATOMIC_RELEASE);
+
+	return ok ? 0 : 1;
+}
+
+static void crash_handler(int signal)
+{
+	static const char msg[] = "Crashed; flight recorder written.\n";
+	ssize_t n = 0;
+
+	if (flight_dump(signal) == 0)
+		n = write(2, msg, sizeof(msg) - 1);
+	(void) n;
+
+	/* The action is back to the default, so this one is fatal. */
+	raise(signal);
+}
+
+/* Starts recording, to be written to path when something goes wrong. */
+void flight_init(const char *path, Uint32 frame_budget_us)
+{
+	static const int signals[] = {
+		SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT,
+	};
+	struct sigaction sa;
+	unsigned int i;
+
+	header.magic = FLIGHT_MAGIC;
+	header.version = FLIGHT_VERSION;
+	header.nr_records = FLIGHT_RECORDS;
+	header.frame_budget_us = frame_budget_us;
+	header.start_ticks = flight_ticks();
+	header.start_ns = flight_ns();
+	dump_path = path;
+
+	flight_thread("main");
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = crash_handler;
+	sa.sa_flags = SA_RESETHAND | SA_ONSTACK;
+	sigemptyset(&sa.sa_mask);
+	for (i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+		sigaction(signals[i], &sa, NULL);
+}
@@ -0,0 +1,71 @@
+#ifndef __FLIGHT_H
+#define __FLIGHT_H
+
+#include <stdint.h>
+
+/*
+ * Flight recorder.
+ *
+ * Every thread that records gets its own ring of fixed size records and
+ * is the only writer to it, so recording is a store and a counter bump.
+ * On a crash, a failed assert or Ctrl+D the rings are written to a file
+ * as a struct flight_header followed by nr_rings struct flight_ring, in
+ * the machine's byte order; tools/flight prints them as one timeline.
+ *
+ * Times are in ticks of a clock that is cheap to read.  The header holds
+ * the tick and nanosecond clocks at startup and at the dump, which gives
+ * the tick rate.  Bump FLIGHT_VERSION when the layout changes.
+ */
+
+#define FLIGHT_MAGIC 0x544c4746u	/* "FGLT" */
+#define FLIGHT_VERSION 1
+
+#define FLIGHT_RINGS 16
+#define FLIGHT_RECORDS 4096		/* a power of two */
+#define FLIGHT_ASSETS 64
+#define FLIGHT_NAME 16
+#define FLIGHT_ASSET_NAME 32
+
+enum flight_type {
+	FLIGHT_RESET,		/* a board, - */
+	FLIGHT_ROTATE,		/* a board, b row */
+	FLIGHT_INVERT,		/* a board, b column */
+	FLIGHT_NEW_ROW,		/* a board, b white mask */
+	FLIGHT_CLEAR,		/* a board, b column | row << 8 */
+	FLIGHT_GRAVITY,		/* a board, b pieces set falling */
+	FLIGHT_SLOW_FRAME,	/* -, b microseconds */
+	FLIGHT_ASSET,		/* a asset, b microseconds to load */
+	NR_FLIGHT_TYPES,
+};
+
+struct flight_record {
+	uint64_t time;
+	uint8_t type;
+	uint8_t pad;
+	uint16_t a;
+	uint32_t b;
+};
+
+struct flight_ring {
+	char name[FLIGHT_NAME];
+	uint64_t head;		/* records written so far */
+	struct flight_record records[FLIGHT_RECORDS];
+} __attribute__((aligned(64)));
+
+struct flight_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nr_rings;
+	uint32_t nr_records;
+	int32_t signal;		/* 0 if asked for */
+	uint32_t frame_budget_us;
+	uint64_t start_ticks;
+	uint64_t start_ns;
+	uint64_t dump_ticks;
+	uint64_t dump_ns;
+	uint32_t nr_assets;
+	uint32_t pad;
+	char assets[FLIGHT_ASSETS][FLIGHT_ASSET_NAME];
+};
+
+#endif
@@ -0,0 +1,568 @@
+#include "game.h"
+
+/* Seconds a piece hangs before falling after a clear, and its speed. */
+#define HOLD_TIME 0.2
+#define FALL_SPEED (16*25)
+#define RISE_SPEED 5
+
+int game_rand(struct game *g)
+{
+	return rand_r(&g->seed);
+}
+
+static void add_event(struct game *g, int type, int a, int b, int mask)
+{
+	static const Uint8 flight_types[] = {
+		[EVENT_RESET] = FLIGHT_RESET,
+		[EVENT_ROTATE] = FLIGHT_ROTATE,
+		[EVENT_INVERT] = FLIGHT_INVERT,
+		[EVENT_NEW_ROW] = FLIGHT_NEW_ROW,
+		[EVENT_CLEAR] = FLIGHT_CLEAR,
+	};
+	struct game_event *e;
+
+	flight_record(flight_types[type], g->id,
+		      type == EVENT_NEW_ROW ? mask : a | b << 8);
+
+	if (g->nr_events == MAX_EVENTS) {
+		g->events_lost = 1;
+		return;
+	}
+
+	e = &g->events[g->nr_events++];
+	e->type = type;
+	e->a = a;
+	e->b = b;
+	e->mask = mask;
+}
+
+static void add_new_row(struct game *g)
+{
+	int i, j;
+	int mask = 0;
+
+	for (i = 0; i < BOARD_WIDTH; i++) {
+		for (j = 0; j < BOARD_HEIGHT - 1; j++) {
+			g->board[i][j] = g->board[i][j + 1];
+		}
+		g->board[i][BOARD_HEIGHT - 1] = g->new_row[i];
+		g->new_row[i] = game_rand(g) % 2 ? WHITE : BLACK;
+		if (g->new_row[i] == WHITE)
+			mask |= 1 << i;
+	}
+
+	g->new_row_delta = 0;
+	g->sounds |= 1 << SOUND_RISE;
+	add_event(g, EVENT_NEW_ROW, 0, 0, mask);
+}
+
+static void rise_done(struct game *g, const struct tween *tw)
+{
+	(void) tw;
+
+	add_new_row(g);
+	anim_add(&g->anim, ANIM_RISE, &g->new_row_delta, 0, 32,
+		 32.0 / RISE_SPEED, rise_done);
+}
+
+static void draw_new_piece(struct game *g, int i, float dy,
+			   SDL_Surface *screen, SDL_Rect *clip)
+{
+	switch (g->new_row[i] & 0x0F) {
+	case BLACK:
+		apply_surface(g->x + i * 32, 480 + dy,
+			      &images.black_image, screen,
+			      clip);
+		break;
+	case WHITE:
+		apply_surface(g->x + i * 32, 480 + dy,
+			      &images.white_image, screen,
+			      clip);
+		break;
+	default:
+		break;
+	}
+}
+
+static void draw_piece(struct game *g, int i, int j, float dx, float dy,
+		       SDL_Surface *screen, SDL_Rect *clip)
+{
+	int rot = -1;
+	const struct sprite *image = NULL;
+	int k;
+
+	if (g->moving_col == i)
+		rot = (int) g->vertical_rotation;
+
+	switch (g->board[i][j] & 0x0F) {
+	case BLACK:
+		if (rot > 0) {
+			k = 3 - rot / 30;
+			if (k < 0)
+				k = 0;
+			image = &images.black_to_white[k];
+		} else {
+			image = &images.black_image;
+		}
+		break;
+	case WHITE:
+		if (rot > 0) {
+			k = rot / 30;
+			if (k > 3)
+				k = 3;
+			image = &images.black_to_white[k];
+		} else {
+			image = &images.white_image;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (image)
+		apply_surface(g->x + i * 32 + dx, j * 32 + dy,
+			      image, screen, clip);
+}
+
+static void draw_board(struct game *g, SDL_Surface *screen)
+{
+	int i, j;
+	float dx, dy;
+	SDL_Rect clip;
+
+	clip.x = 0;
+	clip.y = 0;
+	clip.w = 32;
+	clip.h = 32;
+
+	for (j = 0; j < BOARD_HEIGHT; j++) {
+		for (i = 0; i < BOARD_WIDTH; i++) {
+
+			if (j == g->moving_row)
+				dx = g->horizontal_delta;
+			else
+				dx = 0;
+
+			dy = -g->new_row_delta;
+			dy += g->board_deltas[i][j];
+
+			if (dx < 0 && i == 0) {
+				clip.w = 32;
+				draw_piece(g, i, j, dx, dy, screen, &clip);
+
+				clip.w = -dx;
+				dx += g->board_cols * 32;
+				draw_piece(g, i, j, dx, dy, screen, &clip);
+			} else {
+				clip.w = 32;
+				draw_piece(g, i, j, dx, dy, screen, &clip);
+			}
+		}
+	}
+
+	clip.w = 32;
+	clip.h = -g->new_row_delta;
+	dy = -g->new_row_delta;
+
+	for (i = 0; i < BOARD_WIDTH; i++) {
+		draw_new_piece(g, i, dy, screen, &clip);
+	}
+}
+
+/* Alone, the score sits right of the board; side by side, on top of it. */
+static void draw_score(struct game *g, SDL_Surface *screen, int alone)
+{
+	int s = g->score;
+	int c;
+	SDL_Rect clip;
+	int x = alone ? 500 : g->x + (BOARD_WIDTH - 1) * 32;
+	int y = alone ? 100 : 0;
+
+	clip.y = 0;
+	clip.w = 32;
+	clip.h = 32;
+
+	if (s == 0) {
+		clip.x = 0;
+		apply_surface(x, y, &images.font, screen, &clip);
+		return;
+	}
+
+	while (s > 0) {
+		c = s % 10;
+		s /= 10;
+		clip.x = c * 32;
+		apply_surface(x, y, &images.font, screen, &clip);
+		x -= 32;
+	}
+}
+
+void draw_game(struct game *g, SDL_Surface *screen, int alone)
+{
+	draw_board(g, screen);
+	draw_particles(g, screen);
+	draw_score(g, screen, alone);
+}
+
+static void slide_done(struct game *g, const struct tween *tw)
+{
+	(void) tw;
+
+	g->moving_row = -1;
+}
+
+static void rotate_row(struct game *g, int row)
+{
+	int i;
+	enum spot tmp;
+	struct tween *tw;
+
+	assert(row >= 0);
+	assert(row < BOARD_HEIGHT);
+
+	tmp = g->board[g->board_cols - 1][row];
+	for (i = g->board_cols - 1; i > 0; i--) {
+		g->board[i][row] = g->board[i - 1][row];
+	}
+	g->board[0][row] = tmp;
+
+	g->moving_row = row;
+	tw = anim_add(&g->anim, ANIM_SLIDE, &g->horizontal_delta, -32, 0,
+		      32.0 / (32 * 10), slide_done);
+	tw->ease = EASE_OUT;
+	g->sounds |= 1 << SOUND_ROTATE;
+	add_event(g, EVENT_ROTATE, row, 0, 0);
+}
+
+static void rotate_done(struct game *g, const struct tween *tw)
+{
+	(void) tw;
+
+	g->vertical_rotation = 0;
+	g->moving_col = -1;
+}
+
+static void invert_column(struct game *g, int col)
+{
+	int i;
+
+	assert(col >= 0);
+	assert(col < g->board_cols);
+
+	for (i = 0; i < BOARD_HEIGHT; i++) {
+		if (g->board[col][i] == WHITE)
+			g->board[col][i] = BLACK;
+		else if (g->board[col][i] == BLACK)
+			g->board[col][i] = WHITE;
+	}
+
+	g->moving_col = col;
+	anim_add(&g->anim, ANIM_ROTATE, &g->vertical_rotation, 1, 120,
+		 119.0 / (32 * 20), rotate_done);
+	g->sounds |= 1 << SOUND_INVERT;
+	add_event(g, EVENT_INVERT, col, 0, 0);
+}
+
+void blow_up_block(struct game *g, int i, int j)
+{
+	add_burst(g, i * 32, j * 32, g->board[i][j]);
+}
+
+int figure_out_completed_space(struct game *g, int i, int j)
+{
+	int *a1 = &g->board[i - 1][j - 1];
+	int *a2 = &g->board[i - 1][j - 0];
+	int *a3 = &g->board[i - 1][j + 1];
+	int *b1 = &g->board[i - 0][j - 1];
+	int *b2 = &g->board[i - 0][j - 0];
+	int *b3 = &g->board[i - 0][j + 1];
+	int *c1 = &g->board[i + 1][j - 1];
+	int *c2 = &g->board[i + 1][j - 0];
+	int *c3 = &g->board[i + 1][j + 1];
+
+	if ((*a1 & EMPTY) || (*a2 & EMPTY) || (*a3 & EMPTY)
+	    || (*b1 & EMPTY) || (*b2 & EMPTY) || (*b3 & EMPTY)
+	    || (*c1 & EMPTY) || (*c2 & EMPTY) || (*c3 & EMPTY))
+		return 0;
+
+	if ((*a1 & FALLING) || (*a2 & FALLING) || (*a3 & FALLING)
+	    || (*b1 & FALLING) || (*b2 & FALLING) || (*b3 & FALLING)
+	    || (*c1 & FALLING) || (*c2 & FALLING) || (*c3 & FALLING))
+		return 0;
+
+	if (*a1 == *a2 && *a2 == *a3 && *a3 == *b1
+	    && *b1 == *b2 && *b2 == *b3 && *b3 == *c1
+	    && *c1 == *c2 && *c2 == *c3) {
+		blow_up_block(g, i - 1, j - 1);
+		blow_up_block(g, i - 1, j + 0);
+		blow_up_block(g, i - 1, j + 1);
+		blow_up_block(g, i + 0, j - 1);
+		blow_up_block(g, i + 0, j + 0);
+		blow_up_block(g, i + 0, j + 1);
+		blow_up_block(g, i + 1, j - 1);
+		blow_up_block(g, i + 1, j + 0);
+		blow_up_block(g, i + 1, j + 1);
+
+		*a1 = *a2 = *a3 = EMPTY;
+		*b1 = *b2 = *b3 = EMPTY;
+		*c1 = *c2 = *c3 = EMPTY;
+
+		g->score += 100;
+		g->clears++;
+		g->sounds |= 1 << SOUND_CLEAR;
+		add_event(g, EVENT_CLEAR, i, j, 0);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/* The player may only move while no blocking animation runs. */
+static int pieces_moving(const struct game *g)
+{
+	return g->anim.blocking > 0;
+}
+
+static int figure_out_completed(struct game *g)
+{
+	int i;
+	int j;
+	int modified = 0;
+
+	if (pieces_moving(g))
+		return 0;
+
+	for (i = 1; i < BOARD_WIDTH - 1; i++) {
+		for (j = 1; j < BOARD_HEIGHT - 1; j++) {
+			modified |= figure_out_completed_space(g, i, j);
+		}
+	}
+
+	return modified;
+}
+
+/* Returns 1 if there a piece somewhere above this one. */
+static int piece_above(struct game *g, int pi, int pj)
+{
+	int j;
+
+	for (j = pj - 1; j > 0; j--) {
+		if (g->board[pi][j] != EMPTY)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void fall_step(struct game *g, const struct tween *tw);
+
+/* Starts the next one-cell drop of the falling piece at i, j. */
+static void start_fall(struct game *g, int i, int j, float delay,
+		       float from)
+{
+	struct tween *tw;
+
+	tw = anim_add(&g->anim, ANIM_FALL, &g->board_deltas[i][j], from, 0,
+		      -from / FALL_SPEED, fall_step);
+	tw->t = -delay;
+	tw->i = i;
+	tw->j = j;
+	/* Lower pieces move first so the ones above find the room. */
+	tw->order = BOARD_HEIGHT - j;
+}
+
+/* Moves a falling piece down a cell, or lands it. */
+static void fall_step(struct game *g, const struct tween *tw)
+{
+	int i = tw->i;
+	int j = tw->j;
+
+	if (j < BOARD_HEIGHT - 1 && (g->board[i][j + 1] & EMPTY)) {
+		g->board[i][j + 1] = g->board[i][j];
+		g->board[i][j] = EMPTY;
+		g->board_deltas[i][j] = 0;
+		start_fall(g, i, j + 1, 0, -32);
+	} else {
+		g->board[i][j] &= ~FALLING;
+		g->board_deltas[i][j] = 0;
+	}
+}
+
+static void handle_gravity_for_piece(struct game *g, int i, int j,
+				     float hold_time)
+{
+	int j2;
+
+	if (g->board[i][j] != EMPTY)
+		return;
+
+	if (!piece_above(g, i, j))
+		return;
+
+	for (j2 = j; j2 > 0; j2--) {
+		if (!(g->board[i][j2] & EMPTY)
+		    && !(g->board[i][j2] & FALLING)) {
+			g->board[i][j2] |= FALLING;
+			start_fall(g, i, j2, hold_time, 0);
+		}
+	}
+}
+
+static void handle_gravity(struct game *g, float hold_time)
+{
+	int falling = g->anim.active[ANIM_FALL];
+	int i;
+	int j;
+
+	for (i = BOARD_WIDTH - 1; i >= 0; i--) {
+		for (j = BOARD_HEIGHT - 1; j > 0; j--) {
+			handle_gravity_for_piece(g, i, j, hold_time);
+		}
+	}
+
+	if (g->anim.active[ANIM_FALL] != falling)
+		flight_record(FLIGHT_GRAVITY, g->id,
+			      g->anim.active[ANIM_FALL] - falling);
+}
+
+void handle_mouse(struct game *g, const SDL_Event *event)
+{
+	int col = (event->button.x - g->x) / 32;
+	int row = (event->button.y + g->new_row_delta) / 32;
+
+	/* User cannot do anything while board in motion. */
+	if (pieces_moving(g))
+		return;
+
+	if (event->button.button == SDL_BUTTON_RIGHT) {
+		if (col >= g->board_cols)
+			return;
+		invert_column(g, col);
+	} else if (event->button.button == SDL_BUTTON_LEFT) {
+		if (row >= BOARD_HEIGHT)
+			return;
+		rotate_row(g, row);
+	} else {
+		return;
+	}
+
+	g->moves_made++;
+}
+
+/* Lays the level out in the bottom rows; no new rows rise in puzzles. */
+static void init_puzzle_board(struct game *g, const struct level *level)
+{
+	int i, j, row;
+
+	for (j = 0; j < level->height; j++) {
+		row = BOARD_HEIGHT - level->height + j;
+		for (i = 0; i < level->width; i++)
+			g->board[i][row] = level->rows[j] & (1 << i) ? WHITE : BLACK;
+	}
+
+	for (i = 0; i < BOARD_WIDTH; i++)
+		g->new_row[i] = EMPTY;
+
+	g->board_cols = level->width;
+}
+
+void init_board(struct game *g)
+{
+	int i, j;
+
+	free_particles(g);
+	anim_reset(&g->anim);
+	add_event(g, EVENT_RESET, 0, 0, 0);
+
+	memset(g->board_deltas, 0, sizeof(g->board_deltas));
+	memset(g->new_row, 0, sizeof(g->new_row));
+	g->new_row_delta = 0;
+
+	g->score = 0;
+	g->clears = 0;
+	g->moves_made = 0;
+	g->solved = 0;
+	g->moving_col = -1;
+	g->moving_row = -1;
+	g->vertical_rotation = 0;
+	g->horizontal_delta = 0;
+
+	for (i = 0; i < BOARD_WIDTH; i++)
+		for (j = 0; j < BOARD_HEIGHT; j++)
+			g->board[i][j] = EMPTY;
+
+	if (g->level) {
+		init_puzzle_board(g, g->level);
+		return;
+	}
+
+	g->board_cols = BOARD_WIDTH;
+
+	for (i = 0; i < BOARD_WIDTH; i++)
+		for (j = BOARD_HEIGHT - 10; j < BOARD_HEIGHT; j++)
+			g->board[i][j] = game_rand(g) % 2 ? WHITE : BLACK;
+
+	for (i = 0; i < BOARD_WIDTH; i++)
+		g->new_row[i] = game_rand(g) % 2 ? WHITE : BLACK;
+
+	anim_add(&g->anim, ANIM_RISE, &g->new_row_delta, 0, 32,
+		 32.0 / RISE_SPEED, rise_done);
+}
+
+/* Makes a random move every so often while the board is still. */
+static void autoplay(struct game *g, float dt)
+{
+	if (pieces_moving(g))
+		return;
+
+	g->think_time -= dt;
+	if (g->think_time > 0)
+		return;
+
+	g->think_time = 0.3 + (game_rand(g) % 8) / 10.0;
+
+	if (game_rand(g) % 2)
+		invert_column(g, game_rand(g) % g->board_cols);
+	else
+		rotate_row(g, BOARD_HEIGHT - 1 - game_rand(g) % 10);
+
+	g->moves_made++;
+}
+
+/* Called once every animation holding the board has finished. */
+static void settled(struct game *g)
+{
+	handle_gravity(g, 0);
+	if (figure_out_completed(g) && g->level)
+		g->solved = 1;
+	handle_gravity(g, HOLD_TIME);
+}
+
+void update(struct game *g, float dt)
+{
+	if (anim_update(g, dt))
+		settled(g);
+
+	if (g->autoplay)
+		autoplay(g, dt);
+
+	update_particles(g, dt);
+}
+
+void game_init(struct game *g, const struct level *level, unsigned int seed,
+	       int x)
+{
+	memset(g, 0, sizeof(*g));
+
+	g->level = level;
+	g->seed = seed;
+	g->x = x;
+
+	init_board(g);
+}
+
+void game_free(struct game *g)
+{
+	free_particles(g);
+}
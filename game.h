@@ -6,6 +6,10 @@
 #include "SDL/SDL_image.h"
 
 #include "list.h"
+#include "level.h"
+#include "telemetry.h"
+#include "flight.h"
+#include "tablebase.h"
 
 enum spot {
 	EMPTY   = 0x01,
@@ -16,39 +20,264 @@ enum spot {
 	FALLING = 0x20,
 };
 
+enum sound {
+	SOUND_CLEAR,
+	SOUND_ROTATE,
+	SOUND_INVERT,
+	SOUND_RISE,
+
+	NR_SOUNDS
+};
+
 #define BOARD_WIDTH 10
 #define BOARD_HEIGHT 15
 
-struct particle {
-	float x, y, dx, dy;
-	SDL_Surface *image;
-	float t;
-	float decay;
+#define PARTICLE_GRAVITY (32*20)
+#define BURST_FRAGMENTS 4
+/*
+ * Each cleared tile makes one burst, and a burst fades within 1.3 s, less
+ * than a new row takes to rise: a board never has more bursts alive than
+ * its tiles plus one new row.  Fragment counts in the tens of thousands
+ * come from many boards (-b), not from one.
+ */
+#define MAX_BURSTS (BOARD_WIDTH * (BOARD_HEIGHT + 1))
+
+/* How a sprite's alpha channel lets it be drawn, found when loaded. */
+enum sprite_kind {
+	SPRITE_OPAQUE,		/* every pixel opaque: plain copy */
+	SPRITE_BINARY,		/* every pixel opaque or clear: select */
+	SPRITE_TRANSLUCENT,	/* blend */
+
+	NR_SPRITE_KINDS
+};
+
+struct sprite {
+	SDL_Surface *surface;
+	enum sprite_kind kind;
+};
 
-	struct list_head list;
+/*
+ * A blown up block.  Its fragments are not stored: where each one is and
+ * what it looks like follow from the seed and the time since it was
+ * spawned.
+ */
+struct burst {
+	float age;		/* seconds since it was spawned */
+	Sint16 x, y;		/* top left of the block, board pixels */
+	Uint32 seed;
+	Uint8 white;
 };
 
 struct images {
-	SDL_Surface *background;
-	SDL_Surface *black_image;
-	SDL_Surface *black_to_white[4];
-	SDL_Surface *black_scale[3];
-	SDL_Surface *white_scale[3];
-	SDL_Surface *white_image;
-	SDL_Surface *cursor_image;
-	SDL_Surface *font;
+	struct sprite background;
+	struct sprite black_image;
+	struct sprite black_to_white[4];
+	struct sprite black_scale[3];
+	struct sprite white_scale[3];
+	struct sprite white_image;
+	struct sprite cursor_image;
+	struct sprite font;
+};
+
+enum anim_kind {
+	ANIM_ROTATE,		/* column inversion */
+	ANIM_SLIDE,		/* row rotation */
+	ANIM_FALL,		/* one falling cell */
+	ANIM_RISE,		/* new row coming up */
+
+	NR_ANIM_KINDS
+};
+
+enum ease {
+	EASE_LINEAR,
+	EASE_IN,
+	EASE_OUT,
+	EASE_IN_OUT,
+};
+
+struct game;
+struct tween;
+
+typedef void (*anim_done_fn)(struct game *g, const struct tween *tw);
+
+struct tween {
+	float *value;
+	float from, to;
+	float t;		/* negative while delayed */
+	float duration;
+	Uint8 kind;
+	Uint8 ease;
+	Sint16 order;		/* completion order within one update */
+	Sint16 i, j;		/* cell, for tweens that belong to one */
+	anim_done_fn done;
+};
+
+/* What happened to a board, for observers such as spectators. */
+enum game_event_type {
+	EVENT_RESET,		/* board started over */
+	EVENT_ROTATE,		/* a: row */
+	EVENT_INVERT,		/* a: column */
+	EVENT_NEW_ROW,		/* mask: white cells of the next new row */
+	EVENT_CLEAR,		/* a, b: centre of the block */
+};
+
+struct game_event {
+	Uint8 type;
+	Uint8 a, b;
+	Uint16 mask;
+};
+
+#define MAX_EVENTS 64
+
+/* At most one tween per falling cell plus one of each other kind. */
+#define MAX_TWEENS (BOARD_WIDTH * BOARD_HEIGHT + NR_ANIM_KINDS)
+
+struct anim {
+	struct tween tweens[MAX_TWEENS];
+	int nr_tweens;
+	int blocking;		/* tweens that keep the board moving */
+	int active[NR_ANIM_KINDS];
+};
+
+/*
+ * Everything one board needs.  The simulation functions only touch the
+ * game they are given, so any number of games can run side by side.
+ */
+struct game {
+	int board[BOARD_WIDTH][BOARD_HEIGHT];
+	float board_deltas[BOARD_WIDTH][BOARD_HEIGHT];
+
+	struct anim anim;
+
+	int moving_col;
+	float vertical_rotation;
+	int moving_row;
+	float horizontal_delta;
+
+	int new_row[BOARD_WIDTH];
+	float new_row_delta;
+
+	/* Columns taking part in row rotation; narrower for small puzzles. */
+	int board_cols;
+	/* Puzzle being played, or NULL for the endless game. */
+	const struct level *level;
+
+	int score;
+	int clears;
+	int moves_made;
+	int solved;		/* made a block in a puzzle, reported by main */
+
+	struct burst bursts[MAX_BURSTS];
+	int nr_bursts;
+
+	unsigned int sounds;	/* 1 << enum sound, collected by main */
+
+	/* Events since main last looked; lost is set when some did not fit. */
+	struct game_event events[MAX_EVENTS];
+	int nr_events;
+	int events_lost;
+
+	unsigned int seed;	/* rand_r() state */
+	int autoplay;
+	float think_time;
+
+	int x;			/* left edge on screen */
+	int id;			/* board number in flight records */
+};
+
+struct pool;
+
+struct damage {
+	int row_bytes;
+	int h;
+	int count;
+	int primed;
+	Uint8 *shadow;
+	Uint8 *rows;
 };
 
 extern struct images images;
 extern SDL_Surface *screen;
 
-SDL_Surface *load_image(const char *filename);
-void apply_surface(int x, int y, SDL_Surface *source,
+extern const int SCREEN_WIDTH;
+extern const int SCREEN_HEIGHT;
+
+SDL_Surface *decode_image(const char *filename);
+void set_image(struct sprite *sprite, SDL_Surface *loadedImage);
+void free_image(struct sprite *sprite);
+void apply_surface(int x, int y, const struct sprite *source,
 		   SDL_Surface *destination, SDL_Rect *clip);
 
-struct particle *make_particle(float x, float y, float dx, float dy,
-			       enum spot spot);
-void generate_particle(float x, float y, float dx, float dy,
-		       enum spot spot);
-void draw_particles(SDL_Surface *screen);
-void update_particles(float dt);
+void assets_start(void);
+int assets_poll(void);
+void assets_free(void);
+
+void blit_init(void);
+enum sprite_kind blit_classify(SDL_Surface *surface);
+void blit_convert(struct sprite *sprite, const SDL_PixelFormat *screen);
+void blit_set_palette(SDL_Surface *screen);
+int blit_sprite(int x, int y, const struct sprite *sprite,
+		SDL_Surface *destination, const SDL_Rect *clip);
+
+void game_init(struct game *g, const struct level *level, unsigned int seed,
+	       int x);
+void game_free(struct game *g);
+int game_rand(struct game *g);
+void init_board(struct game *g);
+void update(struct game *g, float dt);
+void handle_mouse(struct game *g, const SDL_Event *event);
+void draw_game(struct game *g, SDL_Surface *screen, int alone);
+
+void add_burst(struct game *g, int x, int y, enum spot spot);
+void free_particles(struct game *g);
+
+void anim_reset(struct anim *anim);
+struct tween *anim_add(struct anim *anim, enum anim_kind kind, float *value,
+		       float from, float to, float duration, anim_done_fn done);
+int anim_update(struct game *g, float dt);
+
+void draw_particles(struct game *g, SDL_Surface *screen);
+void update_particles(struct game *g, float dt);
+
+int audio_init(void);
+void audio_play(enum sound sound);
+void audio_free(void);
+
+struct pool *pool_create(int nr_threads);
+void pool_destroy(struct pool *pool);
+void pool_run(struct pool *pool, void (*fn)(void *item, void *arg),
+	      void **items, int nr_items, void *arg);
+
+int damage_init(struct damage *d, int w, int h, int bytes_per_pixel);
+void damage_free(struct damage *d);
+int damage_update(struct damage *d, SDL_Surface *surface);
+
+int capture_start(const char *filename, SDL_Surface *screen);
+void capture_frame(SDL_Surface *screen);
+void capture_stop(void);
+
+int scale_init(SDL_Surface *video, int factor, SDL_Surface **screen);
+void scale_free(void);
+int scale_present(SDL_Surface *screen);
+
+extern struct telemetry *telemetry;
+
+int telemetry_init(void);
+void telemetry_free(void);
+Uint64 telemetry_now(void);
+
+int load_level(const char *filename, int index, struct level *level);
+
+int tablebase_open(const char *filename);
+void tablebase_close(void);
+int tablebase_hint(const struct game *g, int *row, int *col);
+
+void flight_init(const char *path, Uint32 frame_budget_us);
+void flight_thread(const char *name);
+void flight_record(int type, int a, Uint32 b);
+void flight_asset(const char *name, Uint32 us);
+int flight_dump(int signal);
+
+int spectate_init(const char *address);
+void spectate_frame(struct game *g);
+void spectate_free(void);
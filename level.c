@@ -0,0 +1,44 @@
+#include "game.h"
+
+/* Reads level number index from a file written by tools/levelgen. */
+int load_level(const char *filename, int index, struct level *level)
+{
+	struct level_header header;
+	FILE *in;
+	int ok;
+
+	in = fopen(filename, "rb");
+	if (in == NULL) {
+		fprintf(stderr, "Could not open %s: %s\n",
+			filename, strerror(errno));
+		return 1;
+	}
+
+	ok = fread(&header, sizeof(header), 1, in) == 1
+		&& memcmp(header.magic, LEVEL_MAGIC, sizeof(header.magic)) == 0;
+	if (!ok) {
+		fprintf(stderr, "%s is not a level file.\n", filename);
+		fclose(in);
+		return 1;
+	}
+
+	if (index < 0 || (Uint32) index >= header.count) {
+		fprintf(stderr, "%s has no level %d.\n", filename, index);
+		fclose(in);
+		return 1;
+	}
+
+	ok = fseek(in, sizeof(header) + index * sizeof(*level), SEEK_SET) == 0
+		&& fread(level, sizeof(*level), 1, in) == 1
+		&& level->width >= 3 && level->width <= BOARD_WIDTH
+		&& level->height >= 3 && level->height <= LEVEL_MAX_ROWS;
+	fclose(in);
+
+	if (!ok) {
+		fprintf(stderr, "Could not read level %d from %s.\n",
+			index, filename);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef __LEVEL_H
+#define __LEVEL_H
+
+#include <stdint.h>
+
+/*
+ * Puzzle levels.
+ *
+ * A level is a completely filled board of width x height cells stored as
+ * one bit mask per row, bit i being column i, set for WHITE and clear for
+ * BLACK.  rows[0] is the top row.  A level file is a header followed by
+ * fixed-size records sorted from easiest to hardest, so level n lives at
+ * a known offset.  Fields are in the machine's byte order.
+ */
+
+#define LEVEL_MAGIC "LUNALVL1"
+#define LEVEL_MAX_WIDTH 10
+#define LEVEL_MAX_ROWS 10
+
+struct level_header {
+	char magic[8];
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct level {
+	uint8_t width;
+	uint8_t height;
+	uint8_t moves;		/* fewest moves that produce a 3x3 block */
+	uint8_t reserved;
+	uint16_t solutions;	/* distinct shortest move sequences, capped */
+	uint16_t rows[LEVEL_MAX_ROWS];
+	uint8_t pad[6];
+};
+
+static inline uint16_t level_row_mask(int width)
+{
+	return (1u << width) - 1;
+}
+
+/* Same as rotate_row(): every cell moves one column to the right. */
+static inline uint16_t level_rotate_row(uint16_t row, int width)
+{
+	return ((row << 1) | (row >> (width - 1))) & level_row_mask(width);
+}
+
+static inline void level_invert_column(uint16_t *rows, int height, int col)
+{
+	int j;
+
+	for (j = 0; j < height; j++)
+		rows[j] ^= 1u << col;
+}
+
+/* Returns 1 if the rows contain a 3x3 block of one colour. */
+static inline int level_has_block(const uint16_t *rows, int width, int height)
+{
+	uint16_t mask = level_row_mask(width);
+	uint16_t white, black;
+	int j;
+
+	for (j = 0; j + 2 < height; j++) {
+		white = rows[j] & rows[j + 1] & rows[j + 2];
+		black = ~(rows[j] | rows[j + 1] | rows[j + 2]) & mask;
+		if ((white & (white >> 1) & (white >> 2))
+		    || (black & (black >> 1) & (black >> 2)))
+			return 1;
+	}
+
+	return 0;
+}
+
+#endif
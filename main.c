@@ -1,598 +1,455 @@
+#include <getopt.h>
+#include <unistd.h>
+
 #include "game.h"
 
 const int SCREEN_WIDTH = 640;
 const int SCREEN_HEIGHT = 480;
-const int SCREEN_BPP = 32;
-
-struct images images;
-
-int board[BOARD_WIDTH][BOARD_HEIGHT];
-float board_fall_times[BOARD_WIDTH][BOARD_HEIGHT];
-float board_deltas[BOARD_WIDTH][BOARD_HEIGHT];
-
-int pieces_moving;
-
-int moving_col;
-float vertical_rotation;
-int moving_row;
-float horizontal_delta;
 
-int new_row[BOARD_WIDTH];
-float new_row_delta;
+/* Frames longer than this go in the flight recorder. */
+#define FRAME_BUDGET_US (1000000 / 60)
 
-int cursor_x = 0;
-int cursor_y = 0;
+struct images images;
 
-int score;
+/* Boards are laid out side by side while they fit; the rest run unseen. */
+static struct game **games;
+static int nr_games = 1;
+static int nr_visible;
+static struct pool *pool;
 
-#define HOLD_TIME 2
-#define FALL_SPEED (16*25)
+/* Puzzle mode: set when playing levels from a level file. */
+static const char *level_file;
+static int level_index;
+static struct level level;
 
-static void add_new_row()
+int init(SDL_Surface **screen, int scale, int bpp)
 {
-	int i, j;
-
-	for (i = 0; i < BOARD_WIDTH; i++) {
-		for (j = 0; j < BOARD_HEIGHT - 1; j++) {
-			board[i][j] = board[i][j + 1];
-		}
-		board[i][BOARD_HEIGHT - 1] = new_row[i];
-		new_row[i] = rand() % 2 ? WHITE : BLACK;
-	}
-
-	new_row_delta = 0;
-}
+	SDL_Surface *video;
 
-int init(SDL_Surface **screen)
-{
 	assert(screen);
 
-	if (SDL_Init(SDL_INIT_EVERYTHING) == -1) {
+	/* Audio is brought up later, once something is on screen. */
+	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) == -1) {
 		fprintf(stderr, "SDL_Init failed.\n");
 		return 1;
 	}
 
-	*screen = SDL_SetVideoMode(SCREEN_WIDTH, SCREEN_HEIGHT,
-				  SCREEN_BPP,
-				  SDL_SWSURFACE);
+	video = SDL_SetVideoMode(SCREEN_WIDTH * scale, SCREEN_HEIGHT * scale,
+				 bpp, SDL_SWSURFACE
+				 | (bpp == 8 ? SDL_HWPALETTE : 0));
 
-	if (*screen == NULL) {
+	if (video == NULL) {
 		fprintf(stderr, "SDL_SetVideoMode failed.\n");
 		return 1;
 	}
 
-	SDL_WM_SetCaption("Puzzle Game", NULL);
-
-	return 0;
-}
+	if (video->format->BitsPerPixel == 8)
+		blit_set_palette(video);
 
-void load_files()
-{
-	images.black_image = load_image("assets/black.png");
-	images.white_image = load_image("assets/white.png");
-
-	images.black_to_white[0] = load_image("assets/bw1.png");
-	images.black_to_white[1] = load_image("assets/bw2.png");
-	images.black_to_white[2] = load_image("assets/bw3.png");
-	images.black_to_white[3] = load_image("assets/bw4.png");
-
-	images.black_scale[0] = load_image("assets/black_particle1.png");
-	images.black_scale[1] = load_image("assets/black_particle2.png");
-	images.black_scale[2] = load_image("assets/black_particle3.png");
-	images.white_scale[0] = load_image("assets/white_particle1.png");
-	images.white_scale[1] = load_image("assets/white_particle2.png");
-	images.white_scale[2] = load_image("assets/white_particle3.png");
+	if (scale_init(video, scale, screen) != 0)
+		return 1;
 
-	images.background = load_image("assets/space.png");
+	SDL_WM_SetCaption("Puzzle Game", NULL);
 
-	images.font = load_image("assets/font.png");
+	return 0;
 }
 
 void clean_up()
 {
-	SDL_FreeSurface(images.white_image);
-	SDL_FreeSurface(images.black_image);
-	SDL_FreeSurface(images.black_to_white[0]);
-	SDL_FreeSurface(images.black_to_white[1]);
-	SDL_FreeSurface(images.black_to_white[2]);
-	SDL_FreeSurface(images.black_to_white[3]);
-	SDL_FreeSurface(images.black_scale[0]);
-	SDL_FreeSurface(images.black_scale[1]);
-	SDL_FreeSurface(images.black_scale[2]);
-	SDL_FreeSurface(images.white_scale[0]);
-	SDL_FreeSurface(images.white_scale[1]);
-	SDL_FreeSurface(images.white_scale[2]);
-	SDL_FreeSurface(images.background);
-	SDL_FreeSurface(images.font);
-
+	assets_free();
+	audio_free();
+	scale_free();
 	SDL_Quit();
 }
 
-static void draw_new_piece(int i, float dy, SDL_Surface *screen,
-			   SDL_Rect *clip)
-{
-	switch (new_row[i] & 0x0F) {
-	case BLACK:
-		apply_surface(i * 32, 480 + dy,
-			      images.black_image, screen,
-			      clip);
-		break;
-	case WHITE:
-		apply_surface(i * 32, 480 + dy,
-			      images.white_image, screen,
-			      clip);
-		break;
-	default:
-		break;
-	}
-}
-
-static void draw_piece(int i, int j, float dx, float dy,
-		       SDL_Surface *screen, SDL_Rect *clip)
-{
-	int rot = -1;
-	SDL_Surface *image = NULL;
-	int k;
-
-	if (moving_col == i)
-		rot = (int) vertical_rotation;
-
-	switch (board[i][j] & 0x0F) {
-	case BLACK:
-		if (rot > 0) {
-			k = 3 - rot / 30;
-			if (k < 0)
-				k = 0;
-			image = images.black_to_white[k];
-		} else {
-			image = images.black_image;
-		}
-		break;
-	case WHITE:
-		if (rot > 0) {
-			k = rot / 30;
-			if (k > 3)
-				k = 3;
-			image = images.black_to_white[k];
-		} else {
-			image = images.white_image;
-		}
-		break;
-	default:
-		break;
-	}
-
-	if (image)
-		apply_surface(i * 32 + dx, j * 32 + dy,
-			      image, screen, clip);
-}
-
-static void draw_board(SDL_Surface *screen)
-{
-	int i, j;
-	float dx, dy;
-	SDL_Rect clip;
-
-	clip.x = 0;
-	clip.y = 0;
-	clip.w = 32;
-	clip.h = 32;
-
-	for (j = 0; j < BOARD_HEIGHT; j++) {
-		for (i = 0; i < BOARD_WIDTH; i++) {
-
-			if (j == moving_row)
-				dx = horizontal_delta;
-			else
-				dx = 0;
-
-			dy = -new_row_delta;
-			dy += board_deltas[i][j];
-
-			if (dx < 0 && i == 0) {
-				clip.w = 32;
-				draw_piece(i, j, dx, dy, screen, &clip);
-
-				clip.w = -dx;
-				dx += 10 * 32;
-				draw_piece(i, j, dx, dy, screen, &clip);
-			} else {
-				clip.w = 32;
-				draw_piece(i, j, dx, dy, screen, &clip);
-			}
-		}
-	}
-
-	clip.w = 32;
-	clip.h = -new_row_delta;
-	dy = -new_row_delta;
-
-	for (i = 0; i < BOARD_WIDTH; i++) {
-		draw_new_piece(i, dy, screen, &clip);
-	}
-}
-
-void draw_score(SDL_Surface *screen)
-{
-	int s = score;
-	int c;
-	SDL_Rect clip;
-	int x = 500;
-
-	clip.y = 0;
-	clip.w = 32;
-	clip.h = 32;
-
-	if (s == 0) {
-		clip.x = 0;
-		apply_surface(x, 100, images.font, screen, &clip);
-		return;
-	}
-
-	while (s > 0) {
-		c = s % 10;
-		s /= 10;
-		clip.x = c * 32;
-		apply_surface(x, 100, images.font, screen, &clip);
-		x -= 32;
-	}
-}
-
 int draw(SDL_Surface *screen)
 {
-	apply_surface(0, 0, images.background, screen, NULL);
+	int i;
+
+	apply_surface(0, 0, &images.background, screen, NULL);
 
-	draw_board(screen);
-	draw_particles(screen);
-	draw_score(screen);
+	for (i = 0; i < nr_visible; i++)
+		draw_game(games[i], screen, nr_visible == 1);
 
-	if (SDL_Flip(screen) == -1) {
-		fprintf(stderr, "SDL_Flip failed.\n");
+	if (scale_present(screen) == -1) {
+		fprintf(stderr, "present failed.\n");
 		return 1;
 	}
 
 	return 0;
 }
 
-static void rotate_row(int row)
+void print_fps(int frames, Uint32 start)
 {
-	int i;
-	enum spot tmp;
-
-	assert(row >= 0);
-	assert(row < BOARD_HEIGHT);
+	unsigned int total_ticks, fps;
 
-	tmp = board[BOARD_WIDTH - 1][row];
-	for (i = BOARD_WIDTH - 1; i > 0; i--) {
-		board[i][row] = board[i - 1][row];
-	}
-	board[0][row] = tmp;
+	total_ticks = SDL_GetTicks() - start;
+	if (total_ticks > 1000)
+		fps = frames / (total_ticks / 1000);
+	else
+		fps = 0;
+	printf("FPS: %u (%u)\n", fps, SDL_GetTicks());
+}
 
-	moving_row = row;
-	horizontal_delta = -32;
-	pieces_moving = 1;
+static void announce_level(void)
+{
+	printf("Level %d: make a block in %d moves\n",
+	       level_index + 1, level.moves);
 }
 
-static void invert_column(int col)
+/* Workers only flag a solved board; the player's is reported here. */
+static void report_solved(void)
 {
 	int i;
 
-	assert(col >= 0);
-	assert(col < BOARD_WIDTH);
-
-	for (i = 0; i < BOARD_HEIGHT; i++) {
-		if (board[col][i] == WHITE)
-			board[col][i] = BLACK;
-		else if (board[col][i] == BLACK)
-			board[col][i] = WHITE;
-	}
+	if (games[0]->solved)
+		printf("Level %d solved in %d moves (best %d)\n",
+		       level_index + 1, games[0]->moves_made, level.moves);
 
-	vertical_rotation = 1;
-	moving_col = col;
-	pieces_moving = 1;
+	for (i = 0; i < nr_games; i++)
+		games[i]->solved = 0;
 }
 
-void blow_up_block(int i, int j)
+static void show_hint(void)
 {
-	enum spot spot = board[i][j];
-	generate_particle(i * 32, j * 32, rand() % 2 ? 1 : -1, rand() % 2 ? 1 : -1, spot);
-	generate_particle(i * 32 + 16, j * 32, rand() % 2 ? 1 : -1, rand() % 2 ? 1 : -1, spot);
-	generate_particle(i * 32, j * 32 + 16, rand() % 2 ? 1 : -1, rand() % 2 ? 1 : -1, spot);
-	generate_particle(i * 32 + 16, j * 32 + 16, rand() % 2 ? 1 : -1, rand() % 2 ? 1 : -1, spot);
+	int row, col, moves;
+
+	moves = tablebase_hint(games[0], &row, &col);
+	if (moves < 0)
+		printf("No hint for this board\n");
+	else if (moves == 0)
+		printf("There is a block on the board already\n");
+	else if (row >= 0)
+		printf("Hint: rotate row %d (%d moves to a block)\n",
+		       row - (BOARD_HEIGHT - level.height) + 1, moves);
+	else if (col >= 0)
+		printf("Hint: invert column %d (%d moves to a block)\n",
+		       col + 1, moves);
 }
 
-int figure_out_completed_space(int i, int j)
+static int start_level(int index)
 {
-	int *a1 = &board[i - 1][j - 1];
-	int *a2 = &board[i - 1][j - 0];
-	int *a3 = &board[i - 1][j + 1];
-	int *b1 = &board[i - 0][j - 1];
-	int *b2 = &board[i - 0][j - 0];
-	int *b3 = &board[i - 0][j + 1];
-	int *c1 = &board[i + 1][j - 1];
-	int *c2 = &board[i + 1][j - 0];
-	int *c3 = &board[i + 1][j + 1];
-
-	if ((*a1 & EMPTY) || (*a2 & EMPTY) || (*a3 & EMPTY)
-	    || (*b1 & EMPTY) || (*b2 & EMPTY) || (*b3 & EMPTY)
-	    || (*c1 & EMPTY) || (*c2 & EMPTY) || (*c3 & EMPTY))
-		return 0;
-
-	if ((*a1 & FALLING) || (*a2 & FALLING) || (*a3 & FALLING)
-	    || (*b1 & FALLING) || (*b2 & FALLING) || (*b3 & FALLING)
-	    || (*c1 & FALLING) || (*c2 & FALLING) || (*c3 & FALLING))
-		return 0;
-
-	if (*a1 == *a2 && *a2 == *a3 && *a3 == *b1
-	    && *b1 == *b2 && *b2 == *b3 && *b3 == *c1
-	    && *c1 == *c2 && *c2 == *c3) {
-		blow_up_block(i - 1, j - 1);
-		blow_up_block(i - 1, j + 0);
-		blow_up_block(i - 1, j + 1);
-		blow_up_block(i + 0, j - 1);
-		blow_up_block(i + 0, j + 0);
-		blow_up_block(i + 0, j + 1);
-		blow_up_block(i + 1, j - 1);
-		blow_up_block(i + 1, j + 0);
-		blow_up_block(i + 1, j + 1);
-
-		*a1 = *a2 = *a3 = EMPTY;
-		*b1 = *b2 = *b3 = EMPTY;
-		*c1 = *c2 = *c3 = EMPTY;
-
-		score += 100;
+	int i;
 
+	if (load_level(level_file, index, &level) != 0)
 		return 1;
-	}
+
+	level_index = index;
+	for (i = 0; i < nr_games; i++)
+		init_board(games[i]);
+
+	announce_level();
 
 	return 0;
 }
 
-static int figure_out_completed()
+static int create_games(void)
 {
 	int i;
-	int j;
-	int modified = 0;
 
-	if (pieces_moving)
-		return 0;
+	nr_visible = SCREEN_WIDTH / (BOARD_WIDTH * 32);
+	if (nr_visible > nr_games)
+		nr_visible = nr_games;
 
-	for (i = 1; i < BOARD_WIDTH - 1; i++) {
-		for (j = 1; j < BOARD_HEIGHT - 1; j++) {
-			modified |= figure_out_completed_space(i, j);
-		}
-	}
-
-	return modified;
-}
-
-/* Returns 1 if there a piece somewhere above this one. */
-static int piece_above(int pi, int pj)
-{
-	int j;
+	games = calloc(nr_games, sizeof(*games));
+	if (games == NULL)
+		return 1;
 
-	for (j = pj - 1; j > 0; j--) {
-		if (board[pi][j] != EMPTY)
+	for (i = 0; i < nr_games; i++) {
+		games[i] = malloc(sizeof(*games[i]));
+		if (games[i] == NULL)
 			return 1;
+
+		game_init(games[i], level_file ? &level : NULL, i + 1,
+			  i < nr_visible ? i * BOARD_WIDTH * 32 : 0);
+		games[i]->autoplay = i > 0;
+		games[i]->id = i;
 	}
 
 	return 0;
 }
 
-static void handle_gravity_for_piece(int i, int j, float hold_time)
+static void free_games(void)
 {
-	int j2;
-
-	if (board[i][j] != EMPTY)
-		return;
-
-	if (!piece_above(i, j))
-		return;
+	int i;
 
-	for (j2 = j; j2 > 0; j2--) {
-		if (!(board[i][j2] & EMPTY)
-		    && !(board[i][j2] & FALLING)) {
-			board[i][j2] |= FALLING;
-			board_deltas[i][j2] = 0;
-			board_fall_times[i][j2] = hold_time;
-			pieces_moving = 1;
-		}
+	for (i = 0; i < nr_games; i++) {
+		game_free(games[i]);
+		free(games[i]);
 	}
+	free(games);
 }
 
-static void handle_gravity(float hold_time)
+static void update_game(void *item, void *arg)
 {
-	int i;
-	int j;
-
-	for (i = BOARD_WIDTH - 1; i >= 0; i--) {
-		for (j = BOARD_HEIGHT - 1; j > 0; j--) {
-			handle_gravity_for_piece(i, j, hold_time);
-		}
-	}
+	update(item, *(float *) arg);
 }
 
-/* Returns 1 if the piece is falling. */
-static int handle_falling_piece(int i, int j, float dt)
+/*
+ * Times frames updates of every board at 60 a second, with 1 to
+ * max_threads threads in the pool.  Each run starts from the same boards
+ * and every board plays by itself, so the runs do the same work.
+ */
+static int time_boards(int frames, int max_threads)
 {
-	if (!(board[i][j] & FALLING))
-		return 0;
+	float dt = 1.0 / 60;
+	Uint64 start, us, one = 0;
+	int threads, i;
 
-	if (board_fall_times[i][j] > 0) {
-		board_fall_times[i][j] -= 10 * dt;
-		return 1;
-	}
+	if (max_threads > nr_games)
+		max_threads = nr_games;
+
+	printf("%d boards, %d updates\n", nr_games, frames);
 
-	if (board_deltas[i][j] > -0.10) {
-		if (j == BOARD_HEIGHT - 1) {
-			board[i][j] &= ~FALLING;
-			board_deltas[i][j] = 0;
-			return 0;
-		} else if (board[i][j + 1] & EMPTY) {
-			board[i][j + 1] = board[i][j];
-			board[i][j] = EMPTY;
-			board_deltas[i][j + 1] = -32;
-			board_deltas[i][j] = 0;
+	for (threads = 1; threads <= max_threads; threads++) {
+		if (create_games() != 0) {
+			fprintf(stderr, "Could not allocate %d games.\n",
+				nr_games);
 			return 1;
-		} else {
-			board[i][j] &= ~FALLING;
-			board_deltas[i][j] = 0;
-			return 0;
 		}
-	} else {
-		board_deltas[i][j] += FALL_SPEED * dt;
-		if (board_deltas[i][j] >= 0)
-			board_deltas[i][j] = 0;
-		return 1;
-	}
-}
+		games[0]->autoplay = 1;
 
-static void handle_falling(float dt)
-{
-	int i;
-	int j;
-	int falling = 0;
+		pool = pool_create(threads);
+		if (pool == NULL)
+			return 1;
 
-	for (i = BOARD_WIDTH - 1; i >= 0; i--) {
-		for (j = BOARD_HEIGHT - 1; j > 0; j--) {
-			falling |= handle_falling_piece(i, j, dt);
-		}
+		start = telemetry_now();
+		for (i = 0; i < frames; i++)
+			pool_run(pool, update_game, (void **) games,
+				 nr_games, &dt);
+		us = telemetry_now() - start;
+		if (threads == 1)
+			one = us;
+
+		printf("%3d threads: %9.1f us per update, %5.2fx\n",
+		       threads, (double) us / frames,
+		       us ? (double) one / us : 0.0);
+
+		pool_destroy(pool);
+		free_games();
 	}
 
-	if (pieces_moving)
-		pieces_moving = falling;
+	return 0;
 }
 
-void print_fps(int frames, Uint32 start)
+/* Hands a click to the visible board under the pointer. */
+static void route_mouse(const SDL_Event *event)
 {
-	unsigned int total_ticks, fps;
+	int i = event->button.x / (BOARD_WIDTH * 32);
 
-	total_ticks = SDL_GetTicks() - start;
-	if (total_ticks > 1000)
-		fps = frames / (total_ticks / 1000);
-	else
-		fps = 0;
-	printf("FPS: %u (%u)\n", fps, SDL_GetTicks());
+	if (i < nr_visible && !games[i]->autoplay)
+		handle_mouse(games[i], event);
 }
 
-void handle_mouse(const SDL_Event *event)
+/* Plays the effects the visible boards asked for during this frame. */
+static void play_sounds(void)
 {
-	/* User cannot do anything while board in motion. */
-	if (pieces_moving)
-		return;
-
-	if (event->button.button == SDL_BUTTON_RIGHT) {
-		invert_column(event->button.x / 32);
-	} else if (event->button.button == SDL_BUTTON_LEFT) {
-		rotate_row((event->button.y + new_row_delta) / 32);
+	int i, s;
+
+	for (i = 0; i < nr_visible; i++) {
+		for (s = 0; s < NR_SOUNDS; s++)
+			if (games[i]->sounds & (1 << s))
+				audio_play(s);
+		games[i]->sounds = 0;
 	}
 }
 
-void init_board()
+/* The first board is the one spectators follow. */
+static void publish_events(void)
 {
-	int i, j;
-
-	memset(board_fall_times, 0, sizeof(board_fall_times));
-	memset(board_deltas, 0, sizeof(board_deltas));
-	memset(new_row, 0, sizeof(new_row));
-	new_row_delta = 0;
-
-	pieces_moving = 0;
-
-	score = 0;
-	moving_col = -1;
-	moving_row = -1;
-	vertical_rotation = 0;
-	horizontal_delta = 0;
-
-	for (i = 0; i < BOARD_WIDTH; i++)
-		for (j = 0; j < BOARD_HEIGHT; j++)
-			board[i][j] = EMPTY;
+	int i;
 
-	for (i = 0; i < BOARD_WIDTH; i++)
-		for (j = BOARD_HEIGHT - 10; j < BOARD_HEIGHT; j++)
-			board[i][j] = rand() % 2 ? WHITE : BLACK;
+	spectate_frame(games[0]);
 
-	for (i = 0; i < BOARD_WIDTH; i++)
-		new_row[i] = rand() % 2 ? WHITE : BLACK;
+	for (i = 0; i < nr_games; i++) {
+		games[i]->nr_events = 0;
+		games[i]->events_lost = 0;
+	}
 }
 
-void update(float dt)
+static void publish_telemetry(int frames, Uint64 frame_us,
+			      Uint64 update_us, Uint64 draw_us)
 {
-	int prev_pieces_moving = pieces_moving;
-
-	handle_falling(dt);
-
-	if (moving_col != -1) {
-		pieces_moving = 1;
-
-		if (vertical_rotation > 0) {
-			vertical_rotation += 32 * 20 * dt;
-		}
-
-		if (vertical_rotation > 120) {
-			vertical_rotation = 0;
-			moving_col = -1;
-			pieces_moving = 0;
-		}
-	}
-
-	if (moving_row != -1) {
-		pieces_moving = 1;
-
-		if (horizontal_delta < 0) {
-			horizontal_delta += 32 * 10 * dt;
-			if (horizontal_delta >= 0)
-				horizontal_delta = 0;
-		} else {
-			horizontal_delta = 0;
-			moving_row = -1;
-			pieces_moving = 0;
-		}
+	Uint64 particles = 0, clears = 0, score = 0;
+	Uint64 tweens[NR_ANIM_KINDS] = { 0 };
+	int i, k;
+
+	for (i = 0; i < nr_games; i++) {
+		particles += games[i]->nr_bursts * BURST_FRAGMENTS;
+		clears += games[i]->clears;
+		score += games[i]->score;
+		for (k = 0; k < NR_ANIM_KINDS; k++)
+			tweens[k] += games[i]->anim.active[k];
 	}
 
-	if (prev_pieces_moving && !pieces_moving) {
-		handle_gravity(0);
-		figure_out_completed();
-		handle_gravity(HOLD_TIME);
-	}
+	telemetry_set(telemetry, frames, frames);
+	telemetry_set(telemetry, frame_time_us, frame_us);
+	telemetry_set(telemetry, update_us, update_us);
+	telemetry_set(telemetry, draw_us, draw_us);
+	telemetry_set(telemetry, particles, particles);
+	telemetry_set(telemetry, falling_cells, tweens[ANIM_FALL]);
+	telemetry_set(telemetry, clears, clears);
+	telemetry_set(telemetry, score, score);
+	for (k = 0; k < NR_ANIM_KINDS; k++)
+		telemetry_set(telemetry, tweens[k], tweens[k]);
+}
 
-	if (!pieces_moving) {
-		if (new_row_delta < 32) {
-			new_row_delta += 5 * dt;
-		} else if (new_row_delta > 32) {
-			add_new_row();
-		}
-	}
+static void dump_flight(const char *file)
+{
+	if (flight_dump(0) == 0)
+		printf("Flight recorder written to %s\n", file);
+	else
+		fprintf(stderr, "Could not write %s: %s\n", file,
+			strerror(errno));
+}
 
-	update_particles(dt);
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-r capture.raw] [-s 1-4] [-d 32|16|8] "
+		"[-p levels.dat [-l level]] [-b boards] [-j threads] "
+		"[-S [host:]port|unix:path] [-F flight.rec] [-T table.tb] "
+		"[-B updates]\n",
+		argv0);
 }
 
 int main(int argc, char **argv)
 {
+	Uint64 boot = telemetry_now();
+	int loading = 1;
 	int quit = 0;
 	Uint32 start = 0;
 	int frames = 0;
 	int last_tick = 0;
 	int this_tick = 0;
 	int ticks = 0;
+	Uint64 frame_start, update_end, draw_start, draw_end;
+	Uint32 fps_start;
+	int fps_frames = 0;
 	SDL_Surface *screen;
 	SDL_Event event;
 	float dt;
+	const char *capture_file = NULL;
+	const char *spectate_address = NULL;
+	const char *flight_file = "flight.rec";
+	const char *tablebase_file = NULL;
+	Uint64 frame_us;
+	int scale = 1;
+	int bpp = 32;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int time_frames = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:s:d:p:l:b:j:S:F:T:B:")) != -1) {
+		switch (opt) {
+		case 'r':
+			capture_file = optarg;
+			break;
+		case 's':
+			scale = atoi(optarg);
+			if (scale < 1 || scale > 4) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'd':
+			bpp = atoi(optarg);
+			if (bpp != 32 && bpp != 16 && bpp != 8) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'p':
+			level_file = optarg;
+			break;
+		case 'l':
+			level_index = atoi(optarg) - 1;
+			break;
+		case 'b':
+			nr_games = atoi(optarg);
+			if (nr_games < 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'S':
+			spectate_address = optarg;
+			break;
+		case 'F':
+			flight_file = optarg;
+			break;
+		case 'T':
+			tablebase_file = optarg;
+			break;
+		case 'B':
+			time_frames = atoi(optarg);
+			if (time_frames < 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
 
-	(void) argc;
-	(void) argv;
+	flight_init(flight_file, FRAME_BUDGET_US);
 
-	if (init(&screen) != 0) {
+	/* Timed runs play random boards, whatever -p says. */
+	if (time_frames) {
+		level_file = NULL;
+		return time_boards(time_frames, threads);
+	}
+
+	if (init(&screen, scale, bpp) != 0) {
 		fprintf(stderr, "init failed.\n");
 		return 1;
 	}
 
-	load_files();
-	init_board();
+	if (capture_file && capture_start(capture_file, screen) != 0) {
+		fprintf(stderr, "capture failed.\n");
+		return 1;
+	}
+
+	assets_start();
+
+	if (level_file && load_level(level_file, level_index, &level) != 0)
+		return 1;
+
+	if (tablebase_file && tablebase_open(tablebase_file) != 0)
+		return 1;
+
+	if (create_games() != 0) {
+		fprintf(stderr, "Could not allocate %d games.\n", nr_games);
+		return 1;
+	}
+
+	if (level_file)
+		announce_level();
+
+	pool = pool_create(threads < nr_games ? threads : nr_games);
+	if (pool == NULL)
+		return 1;
+
+	/* Placeholders stand in for whatever has not been decoded yet. */
+	if (draw(screen) != 0) {
+		fprintf(stderr, "draw failed\n");
+		return 1;
+	}
+	printf("First frame after %.1f ms\n", (telemetry_now() - boot) / 1000.0);
+
+	audio_init();
+	telemetry_init();
+
+	if (spectate_address && spectate_init(spectate_address) != 0)
+		return 1;
 
 	start = SDL_GetTicks();
 	last_tick = start;
+	fps_start = start;
 
 	while (quit == 0) {
 		this_tick = SDL_GetTicks();
@@ -601,12 +458,27 @@ int main(int argc, char **argv)
 
 		dt = ticks / 1000.0;
 
-		update(dt);
+		frame_start = telemetry_now();
+		pool_run(pool, update_game, (void **) games, nr_games, &dt);
+		update_end = telemetry_now();
+		play_sounds();
+		publish_events();
+		report_solved();
+
+		if (loading && assets_poll() == 0) {
+			loading = 0;
+			printf("All assets loaded after %.1f ms\n",
+			       (telemetry_now() - boot) / 1000.0);
+		}
 
+		draw_start = telemetry_now();
 		if (draw(screen) != 0) {
 			fprintf(stderr, "draw failed\n");
 			return 1;
 		}
+		draw_end = telemetry_now();
+
+		capture_frame(screen);
 
 		while (SDL_PollEvent(&event)) {
 
@@ -615,7 +487,9 @@ int main(int argc, char **argv)
 				quit = 1;
 				break;
 			case SDL_MOUSEBUTTONUP:
-				handle_mouse(&event);
+				event.button.x /= scale;
+				event.button.y /= scale;
+				route_mouse(&event);
 				break;
 			case SDL_KEYDOWN:
 			case SDL_KEYUP:
@@ -623,6 +497,24 @@ int main(int argc, char **argv)
 				case SDLK_q:
 					quit = 1;
 					break;
+				case SDLK_r:
+					if (level_file && event.type == SDL_KEYUP)
+						start_level(level_index);
+					break;
+				case SDLK_n:
+					if (level_file && event.type == SDL_KEYUP
+					    && start_level(level_index + 1) != 0)
+						start_level(level_index);
+					break;
+				case SDLK_h:
+					if (level_file && event.type == SDL_KEYUP)
+						show_hint();
+					break;
+				case SDLK_d:
+					if (event.type == SDL_KEYUP
+					    && (event.key.keysym.mod & KMOD_CTRL))
+						dump_flight(flight_file);
+					break;
 				default:
 					break;
 				}
@@ -632,10 +524,31 @@ int main(int argc, char **argv)
 			}
 		}
 		frames++;
+
+		fps_frames++;
+		if (this_tick - fps_start >= 1000) {
+			telemetry_set(telemetry, fps,
+				      fps_frames * 1000 / (this_tick - fps_start));
+			fps_start = this_tick;
+			fps_frames = 0;
+		}
+
+		frame_us = telemetry_now() - frame_start;
+		if (frame_us > FRAME_BUDGET_US)
+			flight_record(FLIGHT_SLOW_FRAME, 0, frame_us);
+
+		publish_telemetry(frames, frame_us, update_end - frame_start,
+				  draw_end - draw_start);
 	}
 
 	print_fps(frames, start);
 
+	capture_stop();
+	spectate_free();
+	tablebase_close();
+	telemetry_free();
+	pool_destroy(pool);
+	free_games();
 	clean_up();
 
 	return 0;
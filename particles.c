@@ -1,68 +1,159 @@
 #include "game.h"
 
-LIST_HEAD(particle_list);
+/*
+ * Particle bursts.
+ *
+ * blow_up_block() records one burst per block: where, a seed, the colour
+ * and its age.  Each of its fragments flies on a fixed ballistic path
+ * picked by hashing the seed with the fragment number, and shrinks
+ * through the three particle images at a rate set by its speed.
+ * Positions are closed-form in the age; only the age is advanced per
+ * frame, by update_particles(), which also drops bursts whose fragments
+ * have all faded.  Keeping an age per burst rather than a difference of
+ * ever-growing clocks keeps it exact however long the game runs.  A
+ * fragment is hidden while it is inside an occupied tile or off the
+ * screen.
+ */
 
-struct particle *make_particle(float x, float y, float dx, float dy,
-			       enum spot spot)
+struct fragment {
+	float x, y, dx, dy;
+	float decay;		/* seconds per image stage */
+};
+
+static Uint32 hash32(Uint32 x)
 {
-	struct particle *particle;
+	x ^= x >> 16;
+	x *= 0x7FEB352Du;
+	x ^= x >> 15;
+	x *= 0x846CA68Bu;
+	x ^= x >> 16;
 
-	particle = malloc(sizeof(*particle));
-	particle->x = x;
-	particle->y = y;
-	particle->dx = dx * 32 * 15 * (rand() % 10) / 20.0;
-	particle->dy = dy * 32 * 15 * (rand() % 10) / 20.0;
+	return x;
+}
 
-	particle->image = ((spot & 0xFF) == WHITE)
-		? images.white_scale[0] : images.black_scale[0];
-	particle->t = 0;
-	particle->decay = (fabs(particle->dx) + fabs(particle->dy)) * 0.001;
+static void fragment(const struct burst *b, int k, struct fragment *f)
+{
+	Uint32 h = hash32(b->seed + k * 0x9E3779B9u);
 
-	return particle;
+	f->x = b->x + (k & 1) * 16;
+	f->y = b->y + (k >> 1) * 16;
+	f->dx = (h & 1 ? 1 : -1) * 32 * 15 * ((h >> 8) % 10) / 20.0;
+	f->dy = (h & 2 ? 1 : -1) * 32 * 15 * ((h >> 16) % 10) / 20.0;
+	f->decay = (fabsf(f->dx) + fabsf(f->dy)) * 0.001;
 }
 
-void generate_particle(float x, float y, float dx, float dy,
-		       enum spot spot)
+/* Seconds until the last fragment of b has faded. */
+static float burst_life(const struct burst *b)
 {
-	list_add_tail(&(make_particle(x, y, dx, dy, spot)->list),
-		      &particle_list);
+	struct fragment f;
+	float life = 0;
+	int k;
+
+	for (k = 0; k < BURST_FRAGMENTS; k++) {
+		fragment(b, k, &f);
+		if (f.decay * 3 > life)
+			life = f.decay * 3;
+	}
+
+	return life;
 }
 
-void draw_particles(SDL_Surface *screen)
+void add_burst(struct game *g, int x, int y, enum spot spot)
 {
-	struct particle *p;
+	struct burst *b;
+	int i, oldest = 0;
 
-	list_for_each_entry(p, &particle_list, list) {
-		apply_surface(p->x, p->y,
-			      p->image, screen,
-			      NULL);
+	if (g->nr_bursts < MAX_BURSTS) {
+		b = &g->bursts[g->nr_bursts++];
+	} else {
+		for (i = 1; i < MAX_BURSTS; i++)
+			if (g->bursts[i].age > g->bursts[oldest].age)
+				oldest = i;
+		b = &g->bursts[oldest];
 	}
+
+	b->age = 0;
+	b->x = x;
+	b->y = y;
+	b->seed = game_rand(g);
+	b->white = (spot & 0xFF) == WHITE;
+}
+
+void free_particles(struct game *g)
+{
+	g->nr_bursts = 0;
+}
+
+static int is_solid(const struct game *g, float x, float y)
+{
+	int i, j;
+
+	y += g->new_row_delta;
+	if (x < 0 || y < 0)
+		return 0;
+
+	i = x / 32;
+	j = y / 32;
+	if (i >= BOARD_WIDTH || j > BOARD_HEIGHT)
+		return 0;
+
+	if (j == BOARD_HEIGHT)
+		return !(g->new_row[i] & EMPTY);
+
+	return !(g->board[i][j] & EMPTY);
 }
 
-void update_particles(float dt)
+void draw_particles(struct game *g, SDL_Surface *screen)
 {
-	struct particle *p, *n;
-
-	list_for_each_entry_safe(p, n, &particle_list, list) {
-		p->t += dt;
-		p->x += p->dx * dt;
-		p->y += p->dy * dt;
-
-
-		if (p->t > p->decay && p->t <= p->decay*2) {
-			if (p->image == images.white_scale[0])
-				p->image = images.white_scale[1];
-			if (p->image == images.black_scale[0])
-				p->image = images.black_scale[1];
-		} else if (p->t > p->decay*2 && p->t <= p->decay*3) {
-			if (p->image == images.white_scale[1])
-				p->image = images.white_scale[2];
-			if (p->image == images.black_scale[1])
-				p->image = images.black_scale[2];
-		} else if (p->t > p->decay*3) {
-			list_del(&p->list);
-			free(p);
+	const struct burst *b;
+	const struct sprite *image;
+	struct fragment f;
+	float t, x, y;
+	int n, k, stage;
+
+	for (n = 0; n < g->nr_bursts; n++) {
+		b = &g->bursts[n];
+		t = b->age;
+
+		for (k = 0; k < BURST_FRAGMENTS; k++) {
+			fragment(b, k, &f);
+			if (t >= f.decay * 3)
+				continue;
+
+			stage = t / f.decay;
+			if (stage > 2)
+				stage = 2;
+			image = b->white ? &images.white_scale[stage]
+				: &images.black_scale[stage];
+
+			x = f.x + f.dx * t;
+			y = f.y + f.dy * t + PARTICLE_GRAVITY * t * t / 2;
+
+			if (g->x + x + image->surface->w < 0
+			    || g->x + x >= SCREEN_WIDTH
+			    || y + image->surface->h < 0 || y >= SCREEN_HEIGHT)
+				continue;
+
+			if (is_solid(g, x + image->surface->w / 2,
+				     y + image->surface->h / 2))
+				continue;
+
+			apply_surface(g->x + x, y, image, screen, NULL);
 		}
 	}
 }
 
+void update_particles(struct game *g, float dt)
+{
+	struct burst *b;
+	int n;
+
+	for (n = 0; n < g->nr_bursts; ) {
+		b = &g->bursts[n];
+		b->age += dt;
+		if (b->age >= burst_life(b))
+			*b = g->bursts[--g->nr_bursts];
+		else
+			n++;
+	}
+}
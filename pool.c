@@ -0,0 +1,139 @@
+#include "game.h"
+
+/*
+ * Fixed pool of worker threads.  pool_run() splits the items into one
+ * contiguous shard per thread, the calling thread taking the first one,
+ * and returns once every shard is done.
+ */
+
+struct worker {
+	struct pool *pool;
+	int index;
+	SDL_Thread *thread;
+	SDL_sem *start;
+};
+
+struct pool {
+	int nr_threads;		/* including the caller */
+	struct worker *workers;
+	SDL_sem *done;
+	int quit;
+
+	void (*fn)(void *item, void *arg);
+	void **items;
+	int nr_items;
+	void *arg;
+};
+
+static void run_shard(struct pool *pool, int index)
+{
+	int first = (long) pool->nr_items * index / pool->nr_threads;
+	int last = (long) pool->nr_items * (index + 1) / pool->nr_threads;
+	int i;
+
+	for (i = first; i < last; i++)
+		pool->fn(pool->items[i], pool->arg);
+}
+
+static int worker_thread(void *data)
+{
+	struct worker *w = data;
+	struct pool *pool = w->pool;
+
+	flight_thread("worker");
+
+	for (;;) {
+		SDL_SemWait(w->start);
+		if (pool->quit)
+			break;
+
+		run_shard(pool, w->index);
+		SDL_SemPost(pool->done);
+	}
+
+	return 0;
+}
+
+struct pool *pool_create(int nr_threads)
+{
+	struct pool *pool;
+	struct worker *w;
+	int i;
+
+	if (nr_threads < 1)
+		nr_threads = 1;
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL)
+		return NULL;
+
+	pool->nr_threads = nr_threads;
+	pool->workers = calloc(nr_threads, sizeof(*pool->workers));
+	pool->done = SDL_CreateSemaphore(0);
+	if (pool->workers == NULL || pool->done == NULL) {
+		fprintf(stderr, "Could not create thread pool.\n");
+		if (pool->done)
+			SDL_DestroySemaphore(pool->done);
+		free(pool->workers);
+		free(pool);
+		return NULL;
+	}
+
+	/* Worker 0 is the thread calling pool_run(). */
+	for (i = 1; i < nr_threads; i++) {
+		w = &pool->workers[i];
+		w->pool = pool;
+		w->index = i;
+		w->start = SDL_CreateSemaphore(0);
+		if (w->start)
+			w->thread = SDL_CreateThread(worker_thread, w);
+		if (w->thread == NULL) {
+			fprintf(stderr, "Could not start worker thread: %s\n",
+				SDL_GetError());
+			if (w->start)
+				SDL_DestroySemaphore(w->start);
+			pool->nr_threads = i;
+			break;
+		}
+	}
+
+	return pool;
+}
+
+void pool_destroy(struct pool *pool)
+{
+	int i;
+
+	if (pool == NULL)
+		return;
+
+	pool->quit = 1;
+	for (i = 1; i < pool->nr_threads; i++) {
+		SDL_SemPost(pool->workers[i].start);
+		SDL_WaitThread(pool->workers[i].thread, NULL);
+		SDL_DestroySemaphore(pool->workers[i].start);
+	}
+
+	SDL_DestroySemaphore(pool->done);
+	free(pool->workers);
+	free(pool);
+}
+
+void pool_run(struct pool *pool, void (*fn)(void *item, void *arg),
+	      void **items, int nr_items, void *arg)
+{
+	int i;
+
+	pool->fn = fn;
+	pool->items = items;
+	pool->nr_items = nr_items;
+	pool->arg = arg;
+
+	for (i = 1; i < pool->nr_threads; i++)
+		SDL_SemPost(pool->workers[i].start);
+
+	run_shard(pool, 0);
+
+	for (i = 1; i < pool->nr_threads; i++)
+		SDL_SemWait(pool->done);
+}
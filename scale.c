@@ -0,0 +1,261 @@
+#include "game.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define SCALE_X86
+#endif
+
+/*
+ * Integer upscaling presentation stage.
+ *
+ * The game keeps drawing into a 640x480 logical surface.  When a scale
+ * factor above one is selected, the rows that changed since the last
+ * present are replicated into the k times larger video surface and only
+ * those rows are pushed to the display.
+ */
+
+#define SCALE_MAX 4
+
+typedef void (*scale_row_fn)(Uint32 *dst, const Uint32 *src, int w, int k);
+
+static struct {
+	SDL_Surface *video;
+	SDL_Surface *screen;
+	int factor;
+	struct damage damage;
+	SDL_Rect *rects;
+	scale_row_fn row32;
+	const char *kernel;
+} scaler;
+
+static void scale_row_c(Uint8 *dst, const Uint8 *src, int w, int k, int bpp)
+{
+	int x, i;
+
+	switch (bpp) {
+	case 4:
+		for (x = 0; x < w; x++)
+			for (i = 0; i < k; i++)
+				*((Uint32 *) dst + x * k + i) = *((Uint32 *) src + x);
+		break;
+	case 2:
+		for (x = 0; x < w; x++)
+			for (i = 0; i < k; i++)
+				*((Uint16 *) dst + x * k + i) = *((Uint16 *) src + x);
+		break;
+	case 1:
+		for (x = 0; x < w; x++)
+			memset(dst + x * k, src[x], k);
+		break;
+	default:
+		for (x = 0; x < w; x++)
+			for (i = 0; i < k; i++)
+				memcpy(dst + (x * k + i) * bpp, src + x * bpp, bpp);
+		break;
+	}
+}
+
+static void scale_row32_c(Uint32 *dst, const Uint32 *src, int w, int k)
+{
+	scale_row_c((Uint8 *) dst, (const Uint8 *) src, w, k, 4);
+}
+
+#ifdef SCALE_X86
+__attribute__((target("sse2")))
+static void scale_row32_sse2(Uint32 *dst, const Uint32 *src, int w, int k)
+{
+	int x = 0;
+	__m128i v;
+	__m128i *out = (__m128i *) dst;
+
+	switch (k) {
+	case 2:
+		for (; x + 4 <= w; x += 4) {
+			v = _mm_loadu_si128((const __m128i *) (src + x));
+			_mm_storeu_si128(out++, _mm_unpacklo_epi32(v, v));
+			_mm_storeu_si128(out++, _mm_unpackhi_epi32(v, v));
+		}
+		break;
+	case 3:
+		for (; x + 4 <= w; x += 4) {
+			v = _mm_loadu_si128((const __m128i *) (src + x));
+			_mm_storeu_si128(out++, _mm_shuffle_epi32(v, 0x40));
+			_mm_storeu_si128(out++, _mm_shuffle_epi32(v, 0xA5));
+			_mm_storeu_si128(out++, _mm_shuffle_epi32(v, 0xFE));
+		}
+		break;
+	case 4:
+		for (; x + 4 <= w; x += 4) {
+			v = _mm_loadu_si128((const __m128i *) (src + x));
+			_mm_storeu_si128(out++, _mm_shuffle_epi32(v, 0x00));
+			_mm_storeu_si128(out++, _mm_shuffle_epi32(v, 0x55));
+			_mm_storeu_si128(out++, _mm_shuffle_epi32(v, 0xAA));
+			_mm_storeu_si128(out++, _mm_shuffle_epi32(v, 0xFF));
+		}
+		break;
+	default:
+		break;
+	}
+
+	scale_row32_c((Uint32 *) out, src + x, w - x, k);
+}
+
+__attribute__((target("avx2")))
+static void scale_row32_avx2(Uint32 *dst, const Uint32 *src, int w, int k)
+{
+	int x = 0;
+	int m, l;
+	Sint32 lanes[8];
+	__m256i idx[SCALE_MAX];
+	__m256i v;
+	__m256i *out = (__m256i *) dst;
+
+	/* Output vector m of each group of 8 source pixels takes pixel
+	 * (m * 8 + l) / k into lane l. */
+	for (m = 0; m < k; m++) {
+		for (l = 0; l < 8; l++)
+			lanes[l] = (m * 8 + l) / k;
+		idx[m] = _mm256_loadu_si256((const __m256i *) lanes);
+	}
+
+	for (; x + 8 <= w; x += 8) {
+		v = _mm256_loadu_si256((const __m256i *) (src + x));
+		for (m = 0; m < k; m++)
+			_mm256_storeu_si256(out++,
+					    _mm256_permutevar8x32_epi32(v, idx[m]));
+	}
+
+	scale_row32_c((Uint32 *) out, src + x, w - x, k);
+}
+#endif
+
+int scale_init(SDL_Surface *video, int factor, SDL_Surface **screen)
+{
+	SDL_PixelFormat *fmt = video->format;
+
+	assert(factor >= 1 && factor <= SCALE_MAX);
+
+	memset(&scaler, 0, sizeof(scaler));
+	scaler.video = video;
+	scaler.factor = factor;
+
+	if (factor == 1) {
+		*screen = video;
+		return 0;
+	}
+
+	*screen = SDL_CreateRGBSurface(SDL_SWSURFACE,
+				       video->w / factor, video->h / factor,
+				       fmt->BitsPerPixel, fmt->Rmask,
+				       fmt->Gmask, fmt->Bmask, fmt->Amask);
+	if (*screen == NULL) {
+		fprintf(stderr, "Could not create logical screen: %s\n",
+			SDL_GetError());
+		return 1;
+	}
+	if (fmt->palette)
+		SDL_SetColors(*screen, fmt->palette->colors, 0,
+			      fmt->palette->ncolors);
+
+	scaler.screen = *screen;
+	scaler.rects = malloc((*screen)->h * sizeof(*scaler.rects));
+	if (scaler.rects == NULL
+	    || damage_init(&scaler.damage, (*screen)->w, (*screen)->h,
+			   fmt->BytesPerPixel) != 0) {
+		fprintf(stderr, "Could not allocate scaler buffers.\n");
+		scale_free();
+		*screen = NULL;
+		return 1;
+	}
+
+	scaler.row32 = scale_row32_c;
+	scaler.kernel = "c";
+#ifdef SCALE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		scaler.row32 = scale_row32_avx2;
+		scaler.kernel = "avx2";
+	} else if (__builtin_cpu_supports("sse2")) {
+		scaler.row32 = scale_row32_sse2;
+		scaler.kernel = "sse2";
+	}
+#endif
+
+	printf("Scaling %dx%d by %d (%s)\n", (*screen)->w, (*screen)->h,
+	       factor, fmt->BytesPerPixel == 4 ? scaler.kernel : "c");
+
+	return 0;
+}
+
+void scale_free(void)
+{
+	if (scaler.factor <= 1)
+		return;
+
+	SDL_FreeSurface(scaler.screen);
+	damage_free(&scaler.damage);
+	free(scaler.rects);
+	memset(&scaler, 0, sizeof(scaler));
+}
+
+/* Replicates logical row y into the k video rows it covers. */
+static void scale_row(int y)
+{
+	SDL_Surface *src = scaler.screen;
+	SDL_Surface *dst = scaler.video;
+	int k = scaler.factor;
+	int bpp = src->format->BytesPerPixel;
+	Uint8 *in = (Uint8 *) src->pixels + y * src->pitch;
+	Uint8 *out = (Uint8 *) dst->pixels + y * k * dst->pitch;
+	int i;
+
+	if (bpp == 4)
+		scaler.row32((Uint32 *) out, (const Uint32 *) in, src->w, k);
+	else
+		scale_row_c(out, in, src->w, k, bpp);
+
+	for (i = 1; i < k; i++)
+		memcpy(out + i * dst->pitch, out, dst->w * bpp);
+}
+
+int scale_present(SDL_Surface *screen)
+{
+	int y, n = 0;
+	int k = scaler.factor;
+	SDL_Rect *r;
+
+	if (k <= 1)
+		return SDL_Flip(screen);
+
+	if (SDL_MUSTLOCK(scaler.video) && SDL_LockSurface(scaler.video) < 0)
+		return -1;
+
+	damage_update(&scaler.damage, screen);
+
+	for (y = 0; y < screen->h; y++) {
+		if (!scaler.damage.rows[y])
+			continue;
+
+		scale_row(y);
+
+		/* Merge runs of dirty rows into one update rectangle. */
+		if (n > 0 && scaler.rects[n - 1].y
+		    + scaler.rects[n - 1].h == y * k) {
+			scaler.rects[n - 1].h += k;
+		} else {
+			r = &scaler.rects[n++];
+			r->x = 0;
+			r->y = y * k;
+			r->w = scaler.video->w;
+			r->h = k;
+		}
+	}
+
+	if (SDL_MUSTLOCK(scaler.video))
+		SDL_UnlockSurface(scaler.video);
+
+	if (n > 0)
+		SDL_UpdateRects(scaler.video, n, scaler.rects);
+
+	return 0;
+}
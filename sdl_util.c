@@ -1,11 +1,9 @@
 #include "game.h"
 
-SDL_Surface *load_image(const char *filename)
+/* Decodes an image file; safe to call from any thread. */
+SDL_Surface *decode_image(const char *filename)
 {
-	SDL_Surface *loadedImage = NULL;
-	SDL_Surface *optimizedImage = NULL;
-
-	loadedImage = IMG_Load(filename);
+	SDL_Surface *loadedImage = IMG_Load(filename);
 
 	if (loadedImage == NULL) {
 		fprintf(stderr, "Could not load %s: %s\n",
@@ -13,26 +11,49 @@ SDL_Surface *load_image(const char *filename)
 		assert(0);
 	}
 
+	return loadedImage;
+}
+
+/* Makes a decoded image ready to draw as sprite; frees loadedImage. */
+void set_image(struct sprite *sprite, SDL_Surface *loadedImage)
+{
+	SDL_Surface *optimizedImage = NULL;
+
 	optimizedImage = SDL_DisplayFormatAlpha(loadedImage);
 	SDL_FreeSurface(loadedImage);
 
 	if (optimizedImage == NULL) {
 		fprintf(stderr, "Could not optimize image: %s\n",
-			filename);
+			SDL_GetError());
 		assert(0);
 	}
 
-	return optimizedImage;
+	sprite->surface = optimizedImage;
+	sprite->kind = blit_classify(optimizedImage);
+
+	/* Lets SDL_BlitSurface() copy too when it has to draw one. */
+	if (sprite->kind == SPRITE_OPAQUE)
+		SDL_SetAlpha(optimizedImage, 0, SDL_ALPHA_OPAQUE);
+
+	blit_convert(sprite, SDL_GetVideoSurface()->format);
 }
 
-void apply_surface(int x, int y, SDL_Surface *source,
+void free_image(struct sprite *sprite)
+{
+	SDL_FreeSurface(sprite->surface);
+	sprite->surface = NULL;
+}
+
+void apply_surface(int x, int y, const struct sprite *source,
 		   SDL_Surface *destination, SDL_Rect *clip)
 {
 	SDL_Rect offset;
 
+	if (blit_sprite(x, y, source, destination, clip) == 0)
+		return;
+
 	offset.x = x;
 	offset.y = y;
 
-	SDL_BlitSurface(source, clip, destination, &offset);
+	SDL_BlitSurface(source->surface, clip, destination, &offset);
 }
-
@@ -0,0 +1,618 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "game.h"
+#include "spectate.h"
+
+/*
+ * Spectator server.
+ *
+ * Once a frame the game thread turns the first board's events into
+ * spectate.h messages, adds a cell list for anything the replayed
+ * messages do not account for, and pushes the lot as one chunk on a
+ * single-producer ring.  A keyframe replaces all of that every
+ * KEYFRAME_MS, after a reset and whenever a chunk had to be dropped.
+ *
+ * A server thread moves chunks from the ring to a log of the stream and
+ * writes the log to every client from an epoll loop.  A client is only a
+ * position in the log, so its queue is bounded by CLIENT_BACKLOG: once
+ * it is that far behind it is moved on to the latest keyframe, finishing
+ * the chunk it is in first so it never sees half a message.  A client
+ * the log would overwrite is disconnected.  The game thread never
+ * blocks on any of this.
+ */
+
+#define SPECTATE_QUEUE (256 * 1024)	/* power of two */
+#define SPECTATE_LOG (1024 * 1024)	/* power of two */
+#define SPECTATE_CHUNKS 8192		/* power of two */
+#define SPECTATE_CHUNK 2048
+#define CLIENT_BACKLOG (64 * 1024)
+#define MAX_CLIENTS 1024
+#define KEYFRAME_MS 2000
+#define NO_CHUNK ((Uint64) -1)
+
+/* epoll tags; clients are tagged with their slot plus TAG_CLIENT. */
+#define TAG_WAKE 0
+#define TAG_LISTEN 1
+#define TAG_CLIENT 2
+
+struct client {
+	int fd;
+	Uint64 pos;		/* next byte of the log to send */
+	int skip;		/* move to the latest keyframe at next chunk */
+	int polling;		/* waiting for EPOLLOUT */
+};
+
+static struct {
+	int open;
+	int listen_fd;
+	int wake_fd;
+	int epoll_fd;
+	SDL_Thread *thread;
+	int quit;
+
+	/* Game thread. */
+	struct spec_board model;
+	Uint32 last_keyframe;
+	int need_keyframe;
+	unsigned int dropped;
+
+	/* Chunks, each a 16-bit length and a keyframe flag then the bytes. */
+	Uint8 queue[SPECTATE_QUEUE];
+	unsigned int head;	/* written by the game thread */
+	unsigned int tail;	/* written by the server thread */
+
+	/* Server thread. */
+	Uint8 log[SPECTATE_LOG];
+	Uint64 log_head;
+	Uint64 last_key;	/* offset of the latest keyframe */
+	Uint64 chunks[SPECTATE_CHUNKS];	/* offsets where chunks start */
+	Uint64 nr_chunks;
+
+	struct client clients[MAX_CLIENTS];
+	unsigned int skipped;
+	unsigned int dropped_clients;
+} spec;
+
+static Uint8 spec_cell(int spot)
+{
+	if (spot & WHITE)
+		return SPEC_WHITE;
+	if (spot & BLACK)
+		return SPEC_BLACK;
+
+	return SPEC_EMPTY;
+}
+
+static void copy_board(const struct game *g, struct spec_board *b)
+{
+	int i, j;
+
+	for (i = 0; i < BOARD_WIDTH; i++) {
+		for (j = 0; j < BOARD_HEIGHT; j++)
+			b->cells[i * SPECTATE_HEIGHT + j]
+				= spec_cell(g->board[i][j]);
+		b->new_row[i] = spec_cell(g->new_row[i]);
+	}
+
+	b->cols = g->board_cols;
+	b->score = g->score;
+}
+
+/* Encodes e, applies it to the model and returns its length. */
+static size_t encode_event(const struct game_event *e, Uint8 *out)
+{
+	size_t n;
+
+	switch (e->type) {
+	case EVENT_ROTATE:
+		out[0] = SPEC_ROTATE;
+		out[1] = e->a;
+		n = 2;
+		break;
+	case EVENT_INVERT:
+		out[0] = SPEC_INVERT;
+		out[1] = e->a;
+		n = 2;
+		break;
+	case EVENT_NEW_ROW:
+		out[0] = SPEC_NEW_ROW;
+		out[1] = e->mask;
+		out[2] = e->mask >> 8;
+		n = 3;
+		break;
+	case EVENT_CLEAR:
+		out[0] = SPEC_CLEAR;
+		out[1] = e->a;
+		out[2] = e->b;
+		n = 3;
+		break;
+	default:
+		return 0;
+	}
+
+	spec_apply(&spec.model, out, n);
+
+	return n;
+}
+
+/* Lists what the model has wrong and puts it right. */
+static size_t encode_rest(const struct game *g, Uint8 *out)
+{
+	Uint8 cell;
+	size_t n;
+	int i, j, k;
+	int count = 0;
+
+	out[0] = SPEC_CELLS;
+	for (i = 0; i < BOARD_WIDTH; i++) {
+		for (j = 0; j < BOARD_HEIGHT; j++) {
+			k = i * SPECTATE_HEIGHT + j;
+			cell = spec_cell(g->board[i][j]);
+			if (spec.model.cells[k] == cell)
+				continue;
+			spec.model.cells[k] = cell;
+			out[2 + 2 * count] = k;
+			out[3 + 2 * count] = cell;
+			count++;
+		}
+	}
+	out[1] = count;
+	n = count ? 2 + 2 * count : 0;
+
+	if (spec.model.score != (Uint32) g->score) {
+		spec.model.score = g->score;
+		out[n] = SPEC_SCORE;
+		spec_put32(out + n + 1, g->score);
+		n += 5;
+	}
+
+	return n;
+}
+
+static void push_chunk(const Uint8 *data, size_t len, int keyframe)
+{
+	unsigned int head = spec.head;
+	unsigned int i;
+
+	if (SPECTATE_QUEUE - (head - __atomic_load_n(&spec.tail,
+						     __ATOMIC_ACQUIRE))
+	    < len + 3) {
+		spec.need_keyframe = 1;
+		spec.dropped++;
+		return;
+	}
+
+	spec.queue[head++ % SPECTATE_QUEUE] = len;
+	spec.queue[head++ % SPECTATE_QUEUE] = len >> 8;
+	spec.queue[head++ % SPECTATE_QUEUE] = keyframe;
+	for (i = 0; i < len; i++)
+		spec.queue[head++ % SPECTATE_QUEUE] = data[i];
+
+	__atomic_store_n(&spec.head, head, __ATOMIC_RELEASE);
+}
+
+void spectate_frame(struct game *g)
+{
+	Uint8 chunk[SPECTATE_CHUNK];
+	Uint64 one = 1;
+	Uint32 now = SDL_GetTicks();
+	size_t n = 0;
+	int i;
+
+	if (!spec.open)
+		return;
+
+	if (g->events_lost)
+		spec.need_keyframe = 1;
+	for (i = 0; i < g->nr_events; i++)
+		if (g->events[i].type == EVENT_RESET)
+			spec.need_keyframe = 1;
+
+	if (!spec.need_keyframe) {
+		for (i = 0; i < g->nr_events; i++)
+			n += encode_event(&g->events[i], chunk + n);
+		n += encode_rest(g, chunk + n);
+		if (n)
+			push_chunk(chunk, n, 0);
+	}
+
+	/* Comes after the frame's changes, so it matches what they built. */
+	if (spec.need_keyframe || now - spec.last_keyframe >= KEYFRAME_MS) {
+		copy_board(g, &spec.model);
+		n = spec_keyframe(&spec.model, chunk);
+		spec.need_keyframe = 0;
+		spec.last_keyframe = now;
+		push_chunk(chunk, n, 1);
+	}
+
+	if (n == 0)
+		return;
+
+	if (write(spec.wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		fprintf(stderr, "Could not wake spectator server: %s\n",
+			strerror(errno));
+}
+
+static void drop_client(struct client *c)
+{
+	close(c->fd);
+	c->fd = -1;
+	spec.dropped_clients++;
+}
+
+/* Offset of the first chunk at or after pos, NO_CHUNK if forgotten. */
+static Uint64 next_chunk(Uint64 pos)
+{
+	Uint64 lo, hi, mid;
+
+	lo = spec.nr_chunks > SPECTATE_CHUNKS
+		? spec.nr_chunks - SPECTATE_CHUNKS : 0;
+	hi = spec.nr_chunks;
+	if (lo == hi || spec.chunks[lo % SPECTATE_CHUNKS] > pos)
+		return NO_CHUNK;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (spec.chunks[mid % SPECTATE_CHUNKS] < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < spec.nr_chunks ? spec.chunks[lo % SPECTATE_CHUNKS]
+		: spec.log_head;
+}
+
+static void set_polling(struct client *c, int slot, int polling)
+{
+	struct epoll_event ev;
+
+	if (c->polling == polling)
+		return;
+
+	ev.events = EPOLLIN | EPOLLRDHUP | (polling ? EPOLLOUT : 0);
+	ev.data.u32 = slot + TAG_CLIENT;
+	epoll_ctl(spec.epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->polling = polling;
+}
+
+/*
+ * Deals with a client that has fallen behind: moves it on to the latest
+ * keyframe when it is at the start of a chunk, or drops it.  Returns
+ * where the data it may be sent now ends.
+ */
+static Uint64 check_backlog(struct client *c)
+{
+	Uint64 end;
+
+	if (spec.log_head - c->pos > SPECTATE_LOG / 2) {
+		drop_client(c);
+		return 0;
+	}
+
+	if (spec.log_head - c->pos > CLIENT_BACKLOG
+	    && spec.last_key > c->pos)
+		c->skip = 1;
+
+	if (!c->skip)
+		return spec.log_head;
+
+	end = next_chunk(c->pos);
+	if (end == NO_CHUNK) {
+		drop_client(c);
+		return 0;
+	}
+
+	if (end == c->pos) {
+		c->pos = spec.last_key;
+		c->skip = 0;
+		spec.skipped++;
+		return spec.log_head;
+	}
+
+	return end;
+}
+
+static void flush_client(int slot)
+{
+	struct client *c = &spec.clients[slot];
+	Uint64 end;
+	size_t len;
+	ssize_t sent;
+
+	while (c->fd >= 0 && c->pos < spec.log_head) {
+		end = check_backlog(c);
+		if (c->fd < 0)
+			return;
+
+		len = end - c->pos;
+		if (len > SPECTATE_LOG - c->pos % SPECTATE_LOG)
+			len = SPECTATE_LOG - c->pos % SPECTATE_LOG;
+
+		sent = send(c->fd, spec.log + c->pos % SPECTATE_LOG, len,
+			    MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				set_polling(c, slot, 1);
+				return;
+			}
+			if (errno == EINTR)
+				continue;
+			drop_client(c);
+			return;
+		}
+
+		c->pos += sent;
+	}
+
+	if (c->fd >= 0)
+		set_polling(c, slot, 0);
+}
+
+/* Moves chunks from the game's ring into the log. */
+static void drain_queue(void)
+{
+	unsigned int tail = spec.tail;
+	unsigned int head = __atomic_load_n(&spec.head, __ATOMIC_ACQUIRE);
+	unsigned int len, i;
+	int keyframe;
+
+	while (tail != head) {
+		len = spec.queue[tail++ % SPECTATE_QUEUE];
+		len |= spec.queue[tail++ % SPECTATE_QUEUE] << 8;
+		keyframe = spec.queue[tail++ % SPECTATE_QUEUE];
+
+		if (keyframe)
+			spec.last_key = spec.log_head;
+		spec.chunks[spec.nr_chunks++ % SPECTATE_CHUNKS] = spec.log_head;
+
+		for (i = 0; i < len; i++)
+			spec.log[spec.log_head++ % SPECTATE_LOG]
+				= spec.queue[tail++ % SPECTATE_QUEUE];
+	}
+
+	__atomic_store_n(&spec.tail, tail, __ATOMIC_RELEASE);
+}
+
+static void accept_clients(void)
+{
+	struct epoll_event ev;
+	struct client *c;
+	int fd, slot, one = 1;
+
+	while ((fd = accept4(spec.listen_fd, NULL, NULL,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		for (slot = 0; slot < MAX_CLIENTS; slot++)
+			if (spec.clients[slot].fd < 0)
+				break;
+		if (slot == MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		c = &spec.clients[slot];
+		c->fd = fd;
+		c->pos = spec.last_key;
+		c->skip = 0;
+		c->polling = 0;
+
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.u32 = slot + TAG_CLIENT;
+		if (epoll_ctl(spec.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			drop_client(c);
+			continue;
+		}
+
+		flush_client(slot);
+	}
+}
+
+static int server_thread(void *data)
+{
+	struct epoll_event events[64];
+	struct client *c;
+	Uint64 count;
+	char discard[256];
+	int i, n, slot;
+
+	(void) data;
+
+	flight_thread("spectate");
+
+	while (!__atomic_load_n(&spec.quit, __ATOMIC_ACQUIRE)) {
+		n = epoll_wait(spec.epoll_fd, events, 64, -1);
+
+		for (i = 0; i < n; i++) {
+			switch (events[i].data.u32) {
+			case TAG_WAKE:
+				if (read(spec.wake_fd, &count,
+					 sizeof(count)) < 0)
+					break;
+				drain_queue();
+				for (slot = 0; slot < MAX_CLIENTS; slot++) {
+					c = &spec.clients[slot];
+					if (c->fd < 0)
+						continue;
+					if (c->polling)
+						check_backlog(c);
+					else
+						flush_client(slot);
+				}
+				break;
+			case TAG_LISTEN:
+				accept_clients();
+				break;
+			default:
+				slot = events[i].data.u32 - TAG_CLIENT;
+				c = &spec.clients[slot];
+				if (c->fd < 0)
+					break;
+				if (events[i].events
+				    & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+					close(c->fd);
+					c->fd = -1;
+					break;
+				}
+				if (events[i].events & EPOLLIN)
+					while (read(c->fd, discard,
+						    sizeof(discard)) > 0)
+						;
+				if (events[i].events & EPOLLOUT)
+					flush_client(slot);
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Closes a socket that failed to set up, keeping errno for the report. */
+static int close_failed(int fd)
+{
+	int saved = errno;
+
+	close(fd);
+	errno = saved;
+
+	return -1;
+}
+
+/*
+ * "unix:/path" listens on a Unix socket, "[host:]port" on TCP.  Returns
+ * -1 with errno set on failure.
+ */
+static int open_listener(const char *address)
+{
+	struct sockaddr_un un;
+	struct sockaddr_in in;
+	char host[64] = "127.0.0.1";
+	const char *colon;
+	int fd, one = 1;
+
+	if (strncmp(address, "unix:", 5) == 0) {
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		if (strlen(address + 5) >= sizeof(un.sun_path)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		strcpy(un.sun_path, address + 5);
+		unlink(un.sun_path);
+
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK
+			    | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -1;
+		if (bind(fd, (struct sockaddr *) &un, sizeof(un)) < 0)
+			return close_failed(fd);
+	} else {
+		memset(&in, 0, sizeof(in));
+		in.sin_family = AF_INET;
+		colon = strrchr(address, ':');
+		if (colon && (size_t) (colon - address) < sizeof(host)) {
+			memcpy(host, address, colon - address);
+			host[colon - address] = '\0';
+			address = colon + 1;
+		}
+		in.sin_port = htons(atoi(address));
+		if (inet_pton(AF_INET, host, &in.sin_addr) != 1) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK
+			    | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, (struct sockaddr *) &in, sizeof(in)) < 0)
+			return close_failed(fd);
+	}
+
+	if (listen(fd, 128) < 0)
+		return close_failed(fd);
+
+	return fd;
+}
+
+int spectate_init(const char *address)
+{
+	struct epoll_event ev;
+	int i;
+
+	memset(&spec, 0, sizeof(spec));
+	for (i = 0; i < MAX_CLIENTS; i++)
+		spec.clients[i].fd = -1;
+
+	spec.listen_fd = open_listener(address);
+	if (spec.listen_fd < 0) {
+		fprintf(stderr, "Could not listen on %s: %s\n",
+			address, strerror(errno));
+		return 1;
+	}
+
+	spec.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	spec.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (spec.wake_fd < 0 || spec.epoll_fd < 0) {
+		fprintf(stderr, "Could not set up spectators: %s\n",
+			strerror(errno));
+		return 1;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.u32 = TAG_WAKE;
+	epoll_ctl(spec.epoll_fd, EPOLL_CTL_ADD, spec.wake_fd, &ev);
+	ev.data.u32 = TAG_LISTEN;
+	epoll_ctl(spec.epoll_fd, EPOLL_CTL_ADD, spec.listen_fd, &ev);
+
+	spec.need_keyframe = 1;
+	spec.thread = SDL_CreateThread(server_thread, NULL);
+	if (spec.thread == NULL) {
+		fprintf(stderr, "Could not start spectator server: %s\n",
+			SDL_GetError());
+		return 1;
+	}
+
+	spec.open = 1;
+	printf("Spectators: listening on %s\n", address);
+
+	return 0;
+}
+
+void spectate_free(void)
+{
+	Uint64 one = 1;
+	int i;
+
+	if (!spec.open)
+		return;
+
+	__atomic_store_n(&spec.quit, 1, __ATOMIC_RELEASE);
+	if (write(spec.wake_fd, &one, sizeof(one)) < 0)
+		fprintf(stderr, "Could not stop spectator server: %s\n",
+			strerror(errno));
+	SDL_WaitThread(spec.thread, NULL);
+
+	for (i = 0; i < MAX_CLIENTS; i++)
+		if (spec.clients[i].fd >= 0)
+			close(spec.clients[i].fd);
+	close(spec.listen_fd);
+	close(spec.wake_fd);
+	close(spec.epoll_fd);
+	spec.open = 0;
+
+	printf("Spectators: %u chunks dropped, %u clients skipped ahead, "
+	       "%u disconnected\n", spec.dropped, spec.skipped,
+	       spec.dropped_clients);
+}
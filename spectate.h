@@ -0,0 +1,189 @@
+#ifndef __SPECTATE_H
+#define __SPECTATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Spectator stream.
+ *
+ * The game streams its first board as small messages, each a type byte
+ * followed by a fixed or counted body.  A keyframe carries the whole
+ * board at two bits a cell; after it come moves, new rows and clears,
+ * which the receiver replays with spec_apply(), then cell lists and the
+ * score for whatever else changed (pieces falling).  Keyframes are sent
+ * every few seconds, so a receiver can join, or be skipped forward, at
+ * any of them.  Multi-byte fields are little-endian.
+ */
+
+#define SPECTATE_WIDTH 10
+#define SPECTATE_HEIGHT 15
+#define SPECTATE_CELLS (SPECTATE_WIDTH * SPECTATE_HEIGHT)
+
+#define SPECTATE_PORT 7777
+
+enum spec_cell {
+	SPEC_EMPTY,
+	SPEC_BLACK,
+	SPEC_WHITE,
+};
+
+enum spec_msg {
+	SPEC_KEYFRAME = 'K',	/* cols, score[4], cells and new row[40] */
+	SPEC_ROTATE = 'R',	/* row */
+	SPEC_INVERT = 'I',	/* column */
+	SPEC_NEW_ROW = 'N',	/* white mask of the next row[2] */
+	SPEC_CLEAR = 'C',	/* centre column, centre row */
+	SPEC_CELLS = 'D',	/* count, then count x (cell, value) */
+	SPEC_SCORE = 'S',	/* score[4] */
+};
+
+#define SPEC_KEYFRAME_SIZE (1 + 1 + 4 + (SPECTATE_CELLS + SPECTATE_WIDTH) / 4)
+#define SPEC_MAX_MSG (2 + 2 * 255)
+
+/* Board as a spectator sees it; cell i * SPECTATE_HEIGHT + j. */
+struct spec_board {
+	uint8_t cells[SPECTATE_CELLS];
+	uint8_t new_row[SPECTATE_WIDTH];
+	uint8_t cols;
+	uint32_t score;
+};
+
+static inline uint32_t spec_get32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static inline void spec_put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static inline size_t spec_keyframe(const struct spec_board *b, uint8_t *out)
+{
+	uint8_t *packed = out + 6;
+	int n, v;
+
+	out[0] = SPEC_KEYFRAME;
+	out[1] = b->cols;
+	spec_put32(out + 2, b->score);
+
+	memset(packed, 0, (SPECTATE_CELLS + SPECTATE_WIDTH) / 4);
+	for (n = 0; n < SPECTATE_CELLS + SPECTATE_WIDTH; n++) {
+		v = n < SPECTATE_CELLS ? b->cells[n]
+			: b->new_row[n - SPECTATE_CELLS];
+		packed[n / 4] |= v << (n % 4 * 2);
+	}
+
+	return SPEC_KEYFRAME_SIZE;
+}
+
+/*
+ * Applies the message at p to b.  Returns its length, 0 if len does not
+ * hold all of it yet, or -1 if it is not a valid message.
+ */
+static inline int spec_apply(struct spec_board *b, const uint8_t *p,
+			     size_t len)
+{
+	uint8_t tmp;
+	int i, j, n, v;
+
+	if (len < 1)
+		return 0;
+
+	switch (p[0]) {
+	case SPEC_KEYFRAME:
+		if (len < SPEC_KEYFRAME_SIZE)
+			return 0;
+		if (p[1] < 1 || p[1] > SPECTATE_WIDTH)
+			return -1;
+		b->cols = p[1];
+		b->score = spec_get32(p + 2);
+		for (n = 0; n < SPECTATE_CELLS + SPECTATE_WIDTH; n++) {
+			v = (p[6 + n / 4] >> (n % 4 * 2)) & 3;
+			if (n < SPECTATE_CELLS)
+				b->cells[n] = v;
+			else
+				b->new_row[n - SPECTATE_CELLS] = v;
+		}
+		return SPEC_KEYFRAME_SIZE;
+
+	case SPEC_ROTATE:
+		if (len < 2)
+			return 0;
+		j = p[1];
+		if (j >= SPECTATE_HEIGHT || b->cols < 1)
+			return -1;
+		/* Every cell moves one column to the right. */
+		tmp = b->cells[(b->cols - 1) * SPECTATE_HEIGHT + j];
+		for (i = b->cols - 1; i > 0; i--)
+			b->cells[i * SPECTATE_HEIGHT + j]
+				= b->cells[(i - 1) * SPECTATE_HEIGHT + j];
+		b->cells[j] = tmp;
+		return 2;
+
+	case SPEC_INVERT:
+		if (len < 2)
+			return 0;
+		i = p[1];
+		if (i >= b->cols)
+			return -1;
+		for (j = 0; j < SPECTATE_HEIGHT; j++) {
+			v = b->cells[i * SPECTATE_HEIGHT + j];
+			if (v != SPEC_EMPTY)
+				b->cells[i * SPECTATE_HEIGHT + j] = v ^ 3;
+		}
+		return 2;
+
+	case SPEC_NEW_ROW:
+		if (len < 3)
+			return 0;
+		v = p[1] | p[2] << 8;
+		for (i = 0; i < SPECTATE_WIDTH; i++) {
+			memmove(&b->cells[i * SPECTATE_HEIGHT],
+				&b->cells[i * SPECTATE_HEIGHT + 1],
+				SPECTATE_HEIGHT - 1);
+			b->cells[i * SPECTATE_HEIGHT + SPECTATE_HEIGHT - 1]
+				= b->new_row[i];
+			b->new_row[i] = v & (1 << i) ? SPEC_WHITE : SPEC_BLACK;
+		}
+		return 3;
+
+	case SPEC_CLEAR:
+		if (len < 3)
+			return 0;
+		if (p[1] < 1 || p[1] >= SPECTATE_WIDTH - 1
+		    || p[2] < 1 || p[2] >= SPECTATE_HEIGHT - 1)
+			return -1;
+		for (i = p[1] - 1; i <= p[1] + 1; i++)
+			for (j = p[2] - 1; j <= p[2] + 1; j++)
+				b->cells[i * SPECTATE_HEIGHT + j] = SPEC_EMPTY;
+		return 3;
+
+	case SPEC_CELLS:
+		if (len < 2 || len < 2 + 2 * (size_t) p[1])
+			return 0;
+		for (n = 0; n < p[1]; n++) {
+			if (p[2 + 2 * n] >= SPECTATE_CELLS
+			    || p[3 + 2 * n] > SPEC_WHITE)
+				return -1;
+			b->cells[p[2 + 2 * n]] = p[3 + 2 * n];
+		}
+		return 2 + 2 * p[1];
+
+	case SPEC_SCORE:
+		if (len < 5)
+			return 0;
+		b->score = spec_get32(p + 1);
+		return 5;
+
+	default:
+		return -1;
+	}
+}
+
+#endif
@@ -0,0 +1,135 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "game.h"
+
+/*
+ * Puzzle hints from a tablebase written by tools/tablebase.  The file is
+ * mapped read-only; a hint looks up the board after each possible move
+ * and picks one that brings a block closer.
+ */
+
+static struct {
+	const struct tablebase_header *header;
+	const uint16_t *pilots;
+	const uint8_t *distances;
+	size_t size;
+} tb;
+
+int tablebase_open(const char *filename)
+{
+	const struct tablebase_header *h;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open %s: %s\n",
+			filename, strerror(errno));
+		return 1;
+	}
+
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(*h)) {
+		fprintf(stderr, "%s is not a tablebase.\n", filename);
+		close(fd);
+		return 1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Could not map %s: %s\n",
+			filename, strerror(errno));
+		return 1;
+	}
+
+	h = map;
+	if (memcmp(h->magic, TABLEBASE_MAGIC, sizeof(h->magic)) != 0
+	    || h->width * h->height > TABLEBASE_MAX_CELLS
+	    || h->nr_buckets == 0 || h->nr_slots == 0
+	    || (size_t) st.st_size != sizeof(*h)
+	       + h->nr_buckets * sizeof(*tb.pilots) + h->nr_slots) {
+		fprintf(stderr, "%s is not a tablebase.\n", filename);
+		munmap(map, st.st_size);
+		return 1;
+	}
+
+	tb.header = h;
+	tb.pilots = (const uint16_t *) (h + 1);
+	tb.distances = (const uint8_t *) (tb.pilots + h->nr_buckets);
+	tb.size = st.st_size;
+
+	return 0;
+}
+
+void tablebase_close(void)
+{
+	if (tb.header)
+		munmap((void *) tb.header, tb.size);
+	memset(&tb, 0, sizeof(tb));
+}
+
+static int distance(const uint16_t *rows, int width, int height)
+{
+	return tablebase_lookup(tb.header, tb.pilots, tb.distances,
+				tablebase_canonical(tablebase_pack(rows, width,
+								   height),
+						    width, height));
+}
+
+/*
+ * Finds the best move for a puzzle board: sets *row to the board row to
+ * rotate or *col to the column to invert, the other to -1.  Returns the
+ * moves to a block from here, or -1 if the table cannot tell.
+ */
+int tablebase_hint(const struct game *g, int *row, int *col)
+{
+	uint16_t rows[LEVEL_MAX_ROWS] = { 0 }, saved;
+	int width = g->board_cols, height;
+	int best, d, i, j, top;
+
+	*row = -1;
+	*col = -1;
+
+	if (tb.header == NULL || g->level == NULL
+	    || tb.header->width != width
+	    || tb.header->height != g->level->height)
+		return -1;
+
+	height = g->level->height;
+	top = BOARD_HEIGHT - height;
+	for (j = 0; j < height; j++) {
+		for (i = 0; i < width; i++) {
+			if (g->board[i][top + j] & (EMPTY | FALLING))
+				return -1;
+			if (g->board[i][top + j] & WHITE)
+				rows[j] |= 1u << i;
+		}
+	}
+
+	best = distance(rows, width, height);
+	if (best == 0 || best == TABLEBASE_UNSOLVABLE)
+		return best == 0 ? 0 : -1;
+
+	for (j = 0; j < height && *row < 0; j++) {
+		saved = rows[j];
+		rows[j] = level_rotate_row(rows[j], width);
+		d = distance(rows, width, height);
+		rows[j] = saved;
+		if (d == best - 1)
+			*row = top + j;
+	}
+
+	for (i = 0; i < width && *row < 0 && *col < 0; i++) {
+		level_invert_column(rows, height, i);
+		d = distance(rows, width, height);
+		level_invert_column(rows, height, i);
+		if (d == best - 1)
+			*col = i;
+	}
+
+	return best;
+}
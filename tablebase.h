@@ -0,0 +1,111 @@
+#ifndef __TABLEBASE_H
+#define __TABLEBASE_H
+
+#include <stdint.h>
+
+#include "level.h"
+
+/*
+ * Puzzle tablebases.
+ *
+ * A tablebase holds, for every full board of one size, the fewest
+ * rotate_row/invert_column moves that make a 3x3 block.  A board is
+ * packed into a key with row j (the top row being 0) at bit j * width.
+ * Turning every colour over, or the rows upside down, changes neither
+ * the moves nor the goal, so only the smallest key of those four is
+ * stored.  Rotating the columns is not a symmetry: blocks do not wrap
+ * around the edge.
+ *
+ * The canonical keys are found through a perfect hash built by
+ * tools/tablebase: a key's hash picks a bucket, the bucket's pilot moves
+ * the key to a slot no other key uses, and the slot holds the distance.
+ * The keys themselves are not stored, so a key that is not canonical
+ * for the table's size gives a meaningless answer.
+ *
+ * The file is a struct tablebase_header, then nr_buckets 16 bit pilots,
+ * then nr_slots distance bytes, in the machine's byte order.
+ */
+
+#define TABLEBASE_MAGIC "LUNATB01"
+#define TABLEBASE_MAX_CELLS 28
+#define TABLEBASE_UNSOLVABLE 0xFF
+
+struct tablebase_header {
+	char magic[8];
+	uint8_t width;
+	uint8_t height;
+	uint8_t max_distance;
+	uint8_t reserved;
+	uint32_t nr_keys;
+	uint32_t nr_slots;
+	uint32_t nr_buckets;
+	uint64_t seed;
+};
+
+static inline uint32_t tablebase_pack(const uint16_t *rows, int width,
+				      int height)
+{
+	uint32_t key = 0;
+	int j;
+
+	for (j = 0; j < height; j++)
+		key |= (uint32_t) rows[j] << (j * width);
+
+	return key;
+}
+
+static inline uint32_t tablebase_canonical(uint32_t key, int width,
+					   int height)
+{
+	uint32_t all = (1u << (width * height)) - 1;
+	uint32_t flipped = 0, best = key;
+	int j;
+
+	for (j = 0; j < height; j++)
+		flipped |= (key >> (j * width) & level_row_mask(width))
+			<< ((height - 1 - j) * width);
+
+	if ((key ^ all) < best)
+		best = key ^ all;
+	if (flipped < best)
+		best = flipped;
+	if ((flipped ^ all) < best)
+		best = flipped ^ all;
+
+	return best;
+}
+
+static inline uint64_t tablebase_mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ull;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBull;
+
+	return x ^ (x >> 31);
+}
+
+static inline uint32_t tablebase_bucket(const struct tablebase_header *h,
+					uint64_t hash)
+{
+	return (hash >> 32) % h->nr_buckets;
+}
+
+static inline uint32_t tablebase_slot(const struct tablebase_header *h,
+				      uint64_t hash, uint16_t pilot)
+{
+	return (hash ^ tablebase_mix(pilot + h->seed)) % h->nr_slots;
+}
+
+/* Distance of a canonical key: one hash, one pilot, one byte. */
+static inline uint8_t tablebase_lookup(const struct tablebase_header *h,
+				       const uint16_t *pilots,
+				       const uint8_t *distances, uint32_t key)
+{
+	uint64_t hash = tablebase_mix(key ^ h->seed);
+
+	return distances[tablebase_slot(h, hash,
+					pilots[tablebase_bucket(h, hash)])];
+}
+
+#endif
@@ -0,0 +1,77 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "game.h"
+
+_Static_assert(TELEMETRY_TWEENS == NR_ANIM_KINDS,
+	       "one telemetry tween counter per anim kind");
+
+/* Used when the shared memory block cannot be created, so that callers
+ * never have to check. */
+static struct telemetry local_telemetry;
+
+static char name[TELEMETRY_NAME_MAX];
+
+struct telemetry *telemetry = &local_telemetry;
+
+int telemetry_init(void)
+{
+	struct telemetry *t;
+	int fd;
+
+	snprintf(name, sizeof(name), TELEMETRY_NAME "-%d", (int) getpid());
+	fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open shared memory %s: %s\n",
+			name, strerror(errno));
+		return 1;
+	}
+
+	if (ftruncate(fd, sizeof(*t)) != 0) {
+		fprintf(stderr, "Could not size shared memory %s: %s\n",
+			name, strerror(errno));
+		close(fd);
+		shm_unlink(name);
+		return 1;
+	}
+
+	t = mmap(NULL, sizeof(*t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (t == MAP_FAILED) {
+		fprintf(stderr, "Could not map shared memory %s: %s\n",
+			name, strerror(errno));
+		shm_unlink(name);
+		return 1;
+	}
+
+	t->version = TELEMETRY_VERSION;
+	t->pid = getpid();
+	__atomic_store_n(&t->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+
+	telemetry = t;
+
+	return 0;
+}
+
+void telemetry_free(void)
+{
+	if (telemetry == &local_telemetry)
+		return;
+
+	munmap(telemetry, sizeof(*telemetry));
+	shm_unlink(name);
+	telemetry = &local_telemetry;
+}
+
+/* Monotonic time in microseconds. */
+Uint64 telemetry_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (Uint64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
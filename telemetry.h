@@ -0,0 +1,47 @@
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include <stdint.h>
+
+/*
+ * Live counters published in POSIX shared memory.  The game is the only
+ * writer and stores every field with a relaxed atomic; readers may see a
+ * mix of two frames but never a torn value.  Append new fields at the
+ * end and bump TELEMETRY_VERSION when the layout changes.
+ */
+
+/* Each game publishes its own block, named TELEMETRY_NAME-<pid>. */
+#define TELEMETRY_NAME "/luna-luminance"
+#define TELEMETRY_NAME_MAX 40
+#define TELEMETRY_MAGIC 0x414e554cu	/* "LUNA" */
+#define TELEMETRY_VERSION 2
+
+#define TELEMETRY_TWEENS 4	/* NR_ANIM_KINDS, checked in telemetry.c */
+
+struct telemetry {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t pid;
+
+	uint64_t frames;
+	uint64_t frame_time_us;
+	uint64_t fps;
+	uint64_t update_us;	/* the boards' simulation step only */
+	uint64_t draw_us;
+
+	uint64_t particles;
+	uint64_t falling_cells;
+	uint64_t clears;
+	uint64_t score;
+
+	/* Running tweens by enum anim_kind: rotate, slide, fall, rise. */
+	uint64_t tweens[TELEMETRY_TWEENS];
+} __attribute__((aligned(64)));
+
+#define telemetry_set(t, field, value) \
+	__atomic_store_n(&(t)->field, (value), __ATOMIC_RELAXED)
+
+#define telemetry_get(t, field) \
+	__atomic_load_n(&(t)->field, __ATOMIC_RELAXED)
+
+#endif
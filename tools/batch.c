@@ -0,0 +1,289 @@
+/*
+ * Checks libbatch against a plain model of the rules, then times it.
+ *
+ *   batch [-n boards] [-s steps] [-c cols] [-e rise_every]
+ *
+ * The model keeps one cell per int and plays each board on its own the
+ * way game.c does: the move, then gravity and clears in the game's
+ * order until the board is still.  After every step each board's
+ * reward, done flag and cells must match it.  New rows are random, so
+ * the model takes each one from the batch.  The same number of boards
+ * are then stepped with random moves alone and the rate is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../batch.h"
+
+#define MAX_REPORTS 10
+
+enum { EMPTY, BLACK, WHITE };
+
+struct model {
+	int cell[BATCH_WIDTH][BATCH_HEIGHT];	/* column, then row */
+};
+
+static int cols = BATCH_WIDTH;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void load(struct model *m, const struct batch *b, int board)
+{
+	uint16_t occupied[BATCH_HEIGHT], white[BATCH_HEIGHT];
+	int i, j;
+
+	batch_get(b, board, occupied, white);
+	for (i = 0; i < BATCH_WIDTH; i++)
+		for (j = 0; j < BATCH_HEIGHT; j++)
+			m->cell[i][j] = !(occupied[j] >> i & 1) ? EMPTY
+				: white[j] >> i & 1 ? WHITE : BLACK;
+}
+
+static void apply_move(struct model *m, int move)
+{
+	int i, j, last;
+
+	if (move < BATCH_HEIGHT) {
+		j = move;
+		last = m->cell[cols - 1][j];
+		for (i = cols - 1; i > 0; i--)
+			m->cell[i][j] = m->cell[i - 1][j];
+		m->cell[0][j] = last;
+	} else if (move < BATCH_HEIGHT + cols) {
+		i = move - BATCH_HEIGHT;
+		for (j = 0; j < BATCH_HEIGHT; j++)
+			if (m->cell[i][j] != EMPTY)
+				m->cell[i][j] ^= BLACK ^ WHITE;
+	}
+}
+
+static void gravity(struct model *m)
+{
+	int i, j, k;
+
+	for (i = 0; i < cols; i++) {
+		k = BATCH_HEIGHT - 1;
+		for (j = BATCH_HEIGHT - 1; j >= 0; j--)
+			if (m->cell[i][j] != EMPTY)
+				m->cell[i][k--] = m->cell[i][j];
+		while (k >= 0)
+			m->cell[i][k--] = EMPTY;
+	}
+}
+
+/* Clears blocks, leftmost centre then topmost first; returns how many. */
+static int clear_blocks(struct model *m)
+{
+	int i, j, di, dj, c, same, n = 0;
+
+	for (i = 1; i < cols - 1; i++) {
+		for (j = 1; j < BATCH_HEIGHT - 1; j++) {
+			c = m->cell[i][j];
+			if (c == EMPTY)
+				continue;
+
+			same = 1;
+			for (di = -1; di <= 1; di++)
+				for (dj = -1; dj <= 1; dj++)
+					same &= m->cell[i + di][j + dj] == c;
+			if (!same)
+				continue;
+
+			for (di = -1; di <= 1; di++)
+				for (dj = -1; dj <= 1; dj++)
+					m->cell[i + di][j + dj] = EMPTY;
+			n++;
+		}
+	}
+
+	return n;
+}
+
+static int step(struct model *m, int move)
+{
+	int n, cleared = 0;
+
+	apply_move(m, move);
+	do {
+		gravity(m);
+		n = clear_blocks(m);
+		cleared += n;
+	} while (n);
+
+	return cleared * BATCH_CLEAR_REWARD;
+}
+
+/*
+ * Pushes the board up a row, taking the new one from board of b; returns
+ * 1 if it topped out instead.
+ */
+static int rise(struct model *m, const struct batch *b, int board)
+{
+	uint16_t occupied[BATCH_HEIGHT], white[BATCH_HEIGHT];
+	int i, j;
+
+	for (i = 0; i < cols; i++)
+		if (m->cell[i][0] != EMPTY)
+			return 1;
+
+	batch_get(b, board, occupied, white);
+	for (i = 0; i < cols; i++) {
+		for (j = 0; j < BATCH_HEIGHT - 1; j++)
+			m->cell[i][j] = m->cell[i][j + 1];
+		m->cell[i][BATCH_HEIGHT - 1] =
+			white[BATCH_HEIGHT - 1] >> i & 1 ? WHITE : BLACK;
+	}
+
+	return 0;
+}
+
+static int is_empty(const struct model *m)
+{
+	int i, j;
+
+	for (i = 0; i < cols; i++)
+		for (j = 0; j < BATCH_HEIGHT; j++)
+			if (m->cell[i][j] != EMPTY)
+				return 0;
+
+	return 1;
+}
+
+static void random_moves(uint8_t *moves, size_t n)
+{
+	size_t k;
+	int x;
+
+	/* One in BATCH_HEIGHT + cols + 1 waits. */
+	for (k = 0; k < n; k++) {
+		x = rand() % (BATCH_HEIGHT + cols + 1);
+		moves[k] = x < BATCH_HEIGHT + cols ? x : BATCH_WAIT;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct batch_config config = { BATCH_WIDTH, 10, 8, 1 };
+	struct model *models, batch_model;
+	struct batch *b;
+	uint8_t *moves, *done;
+	int32_t *rewards;
+	void *memory;
+	long clears = 0, restarts = 0, differences = 0;
+	int n = 4096, steps = 1000;
+	int s, k, due, reward, over, opt;
+	double start, seconds;
+
+	while ((opt = getopt(argc, argv, "n:s:c:e:")) != -1) {
+		switch (opt) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 's':
+			steps = atoi(optarg);
+			break;
+		case 'c':
+			config.cols = atoi(optarg);
+			break;
+		case 'e':
+			config.rise_every = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n boards] [-s steps] "
+				"[-c cols] [-e rise_every]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (n < 1 || steps < 1) {
+		fprintf(stderr, "usage: %s [-n boards] [-s steps] "
+			"[-c cols] [-e rise_every]\n", argv[0]);
+		return 1;
+	}
+	cols = config.cols;
+
+	memory = malloc(batch_size(n));
+	models = malloc(n * sizeof(*models));
+	moves = malloc((size_t) n * steps);
+	rewards = malloc(n * sizeof(*rewards));
+	done = malloc(n);
+	if (memory == NULL || models == NULL || moves == NULL
+	    || rewards == NULL || done == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+
+	b = batch_init(memory, n, &config);
+	if (b == NULL) {
+		fprintf(stderr, "Columns must be 3 to %d and rise_every at "
+			"least 0.\n", BATCH_WIDTH);
+		return 1;
+	}
+
+	srand(1);
+	for (k = 0; k < n; k++)
+		load(&models[k], b, k);
+
+	for (s = 1; s <= steps; s++) {
+		random_moves(moves, n);
+		due = config.rise_every && s % config.rise_every == 0;
+		batch_step(b, moves, rewards, done);
+
+		for (k = 0; k < n; k++) {
+			reward = step(&models[k], moves[k]);
+			over = due && rise(&models[k], b, k);
+			over |= is_empty(&models[k]);
+
+			load(&batch_model, b, k);
+			if (reward != rewards[k] || over != done[k]
+			    || (!over && memcmp(&batch_model, &models[k],
+						sizeof(batch_model)))) {
+				if (differences++ < MAX_REPORTS)
+					printf("Board %d differs after step "
+					       "%d, move %d.\n", k, s,
+					       moves[k]);
+			}
+
+			/* A finished board has started over. */
+			if (done[k] || over) {
+				models[k] = batch_model;
+				restarts++;
+			}
+			clears += rewards[k] / BATCH_CLEAR_REWARD;
+		}
+	}
+
+	printf("%d boards of %d columns, %d steps: %ld clears, %ld "
+	       "restarts, %ld differences\n", n, cols, steps, clears,
+	       restarts, differences);
+
+	/* Timing: the moves are made up front, as a policy would. */
+	b = batch_init(memory, n, &config);
+	random_moves(moves, (size_t) n * steps);
+	start = now();
+	for (s = 0; s < steps; s++)
+		batch_step(b, moves + (size_t) s * n, rewards, done);
+	seconds = now() - start;
+
+	printf("%.1f million board steps a second\n",
+	       (double) n * steps / seconds / 1e6);
+
+	free(done);
+	free(rewards);
+	free(moves);
+	free(models);
+	free(memory);
+
+	return differences != 0;
+}
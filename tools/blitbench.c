@@ -0,0 +1,214 @@
+/*
+ * Times blit_sprite() against SDL_BlitSurface() for every sprite kind at
+ * every screen depth.
+ *
+ *   blitbench [-n blits] [-s size]
+ *
+ * Each sprite is size pixels square (default 32, a tile) and is drawn
+ * n times at the same spread of places on a 640x480 surface in the
+ * screen's format, a few of them clipped by its edges.  Sprites are
+ * classified and converted as set_image() does, so both sides draw what
+ * the game would draw at that depth.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../game.h"
+
+#define WIDTH 640
+#define HEIGHT 480
+
+static const char *kind_names[NR_SPRITE_KINDS] = {
+	"opaque", "binary", "translucent",
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static SDL_Surface *make_screen(int depth)
+{
+	SDL_Surface *s;
+
+	switch (depth) {
+	case 32:
+		return SDL_CreateRGBSurface(SDL_SWSURFACE, WIDTH, HEIGHT, 32,
+					    0xFF0000, 0xFF00, 0xFF, 0);
+	case 16:
+		return SDL_CreateRGBSurface(SDL_SWSURFACE, WIDTH, HEIGHT, 16,
+					    0xF800, 0x07E0, 0x001F, 0);
+	default:
+		s = SDL_CreateRGBSurface(SDL_SWSURFACE, WIDTH, HEIGHT, 8,
+					 0, 0, 0, 0);
+		if (s)
+			blit_set_palette(s);
+		return s;
+	}
+}
+
+/*
+ * A size x size ARGB8888 sprite of kind: random colours under an alpha
+ * that is all opaque, a disc on a clear ground, or a radial fade.
+ */
+static int make_sprite(struct sprite *sprite, enum sprite_kind kind,
+		       int size, const SDL_PixelFormat *screen)
+{
+	SDL_Surface *s;
+	Uint32 *row, a;
+	int x, y, dx, dy, r2 = size * size / 4;
+
+	s = SDL_CreateRGBSurface(SDL_SWSURFACE, size, size, 32, 0xFF0000,
+				 0xFF00, 0xFF, 0xFF000000);
+	if (s == NULL)
+		return 1;
+
+	for (y = 0; y < size; y++) {
+		row = (Uint32 *) ((Uint8 *) s->pixels + y * s->pitch);
+		for (x = 0; x < size; x++) {
+			dx = 2 * x + 1 - size;
+			dy = 2 * y + 1 - size;
+			if (kind == SPRITE_OPAQUE)
+				a = 255;
+			else if (kind == SPRITE_BINARY)
+				a = dx * dx + dy * dy < 4 * r2 ? 255 : 0;
+			else
+				a = 255 - 255 * (dx * dx + dy * dy)
+					/ (8 * r2 + 1);
+			row[x] = a << 24 | (rand() & 0xFFFFFF);
+		}
+	}
+
+	sprite->surface = s;
+	sprite->kind = blit_classify(s);
+	if (sprite->kind == SPRITE_OPAQUE)
+		SDL_SetAlpha(s, 0, SDL_ALPHA_OPAQUE);
+	blit_convert(sprite, screen);
+
+	return 0;
+}
+
+/* Nanoseconds per blit_sprite(), or -1 if it leaves this one to SDL. */
+static double time_blit_sprite(const struct sprite *sprite,
+			       SDL_Surface *screen, const SDL_Rect *at, int n)
+{
+	double start = now();
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (blit_sprite(at[i].x, at[i].y, sprite, screen, NULL))
+			return -1;
+
+	return (now() - start) * 1e9 / n;
+}
+
+static double time_sdl(const struct sprite *sprite, SDL_Surface *screen,
+		       const SDL_Rect *at, int n)
+{
+	double start = now();
+	SDL_Rect offset;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		offset = at[i];
+		SDL_BlitSurface(sprite->surface, NULL, screen, &offset);
+	}
+
+	return (now() - start) * 1e9 / n;
+}
+
+int main(int argc, char **argv)
+{
+	static const int depths[] = { 32, 16, 8 };
+	struct sprite sprite;
+	SDL_Surface *screen;
+	SDL_Rect *at;
+	double ours, sdl;
+	int n = 200000, size = 32;
+	int d, k, i, opt;
+
+	while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n blits] [-s size]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (n < 1 || size < 1 || size > HEIGHT) {
+		fprintf(stderr, "usage: %s [-n blits] [-s size]\n", argv[0]);
+		return 1;
+	}
+
+	at = malloc(n * sizeof(*at));
+	if (at == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+
+	/* Anywhere from half off the left or top to half off the right. */
+	srand(1);
+	for (i = 0; i < n; i++) {
+		at[i].x = rand() % WIDTH - size / 2;
+		at[i].y = rand() % HEIGHT - size / 2;
+	}
+
+	blit_init();
+
+	printf("%dx%d sprites, %d blits each\n\n", size, size, n);
+	printf("depth  sprite       blit_sprite  SDL_BlitSurface\n");
+
+	for (d = 0; d < (int) (sizeof(depths) / sizeof(depths[0])); d++) {
+		screen = make_screen(depths[d]);
+		if (screen == NULL) {
+			fprintf(stderr, "Could not make a %d bpp surface: "
+				"%s\n", depths[d], SDL_GetError());
+			return 1;
+		}
+
+		for (k = 0; k < NR_SPRITE_KINDS; k++) {
+			if (make_sprite(&sprite, k, size, screen->format)) {
+				fprintf(stderr, "Could not make a sprite: "
+					"%s\n", SDL_GetError());
+				return 1;
+			}
+
+			ours = time_blit_sprite(&sprite, screen, at, n);
+			sdl = time_sdl(&sprite, screen, at, n);
+
+			printf("%5d  %-11s  ", depths[d], kind_names[k]);
+			if (ours < 0)
+				printf("%11s", "(uses SDL)");
+			else
+				printf("%8.1f ns", ours);
+			printf("  %12.1f ns", sdl);
+			if (ours > 0)
+				printf("  %5.2fx", sdl / ours);
+			if ((int) sprite.kind != k)
+				printf("  (drawn %s)", kind_names[sprite.kind]);
+			printf("\n");
+
+			SDL_FreeSurface(sprite.surface);
+		}
+
+		SDL_FreeSurface(screen);
+	}
+
+	free(at);
+
+	return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * Prints a flight recorder dump as one timeline.
+ *
+ *   flight [-n last] [-b board] flight.rec
+ *
+ * Records from every thread are merged by time, which is shown in
+ * seconds since the game started.  -n keeps only the last records and
+ * -b only the events of one board.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../flight.h"
+
+struct entry {
+	struct flight_record r;
+	int ring;
+};
+
+static struct flight_header header;
+static struct flight_ring *rings;
+
+static int by_time(const void *a, const void *b)
+{
+	const struct entry *x = a, *y = b;
+
+	if (x->r.time != y->r.time)
+		return x->r.time < y->r.time ? -1 : 1;
+
+	return x->ring - y->ring;
+}
+
+static int is_board_event(int type)
+{
+	return type <= FLIGHT_GRAVITY;
+}
+
+static void print_record(const struct flight_record *r, double seconds,
+			 const char *thread)
+{
+	double ms = r->b / 1000.0;
+
+	printf("%12.6f  %-8s  ", seconds, thread);
+
+	switch (r->type) {
+	case FLIGHT_RESET:
+		printf("board %u reset\n", r->a);
+		break;
+	case FLIGHT_ROTATE:
+		printf("board %u rotate row %u\n", r->a, r->b & 0xFF);
+		break;
+	case FLIGHT_INVERT:
+		printf("board %u invert column %u\n", r->a, r->b & 0xFF);
+		break;
+	case FLIGHT_NEW_ROW:
+		printf("board %u new row, white mask %03x\n", r->a, r->b);
+		break;
+	case FLIGHT_CLEAR:
+		printf("board %u clear around %u,%u\n", r->a, r->b & 0xFF,
+		       r->b >> 8 & 0xFF);
+		break;
+	case FLIGHT_GRAVITY:
+		printf("board %u gravity, %u pieces falling\n", r->a, r->b);
+		break;
+	case FLIGHT_SLOW_FRAME:
+		printf("frame took %.1f ms (budget %.1f ms)\n", ms,
+		       header.frame_budget_us / 1000.0);
+		break;
+	case FLIGHT_ASSET:
+		printf("loaded %s in %.1f ms\n",
+		       r->a < header.nr_assets ? header.assets[r->a] : "?", ms);
+		break;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct entry *entries;
+	const struct flight_ring *ring;
+	const struct flight_record *r;
+	double ticks_per_s;
+	long last = 0, board = -1;
+	size_t nr = 0, first = 0, i;
+	uint64_t head, n, k;
+	unsigned int j;
+	FILE *f;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:b:")) != -1) {
+		switch (opt) {
+		case 'n':
+			last = atol(optarg);
+			break;
+		case 'b':
+			board = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n last] [-b board] "
+				"flight.rec\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-n last] [-b board] flight.rec\n",
+			argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[optind], "rb");
+	if (f == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if (fread(&header, sizeof(header), 1, f) != 1
+	    || header.magic != FLIGHT_MAGIC) {
+		fprintf(stderr, "%s is not a flight recorder dump.\n",
+			argv[optind]);
+		return 1;
+	}
+	if (header.version != FLIGHT_VERSION
+	    || header.nr_records != FLIGHT_RECORDS
+	    || header.nr_rings > FLIGHT_RINGS) {
+		fprintf(stderr, "%s is version %u, expected %u.\n",
+			argv[optind], header.version, FLIGHT_VERSION);
+		return 1;
+	}
+	if (header.nr_assets > FLIGHT_ASSETS)
+		header.nr_assets = FLIGHT_ASSETS;
+
+	rings = calloc(header.nr_rings + 1, sizeof(*rings));
+	entries = calloc((size_t) (header.nr_rings + 1) * FLIGHT_RECORDS,
+			 sizeof(*entries));
+	if (rings == NULL || entries == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+	if (fread(rings, sizeof(*rings), header.nr_rings, f)
+	    != header.nr_rings) {
+		fprintf(stderr, "%s is truncated.\n", argv[optind]);
+		return 1;
+	}
+	fclose(f);
+
+	ticks_per_s = header.dump_ns > header.start_ns
+		? (double) (header.dump_ticks - header.start_ticks)
+		/ (header.dump_ns - header.start_ns) * 1e9 : 1e9;
+
+	/*
+	 * The newest record of a ring may have been half written, so
+	 * anything outside the recording's time span is dropped.
+	 */
+	for (j = 0; j < header.nr_rings; j++) {
+		ring = &rings[j];
+		head = ring->head;
+		n = head < FLIGHT_RECORDS ? head : FLIGHT_RECORDS;
+
+		for (k = head - n; k < head; k++) {
+			r = &ring->records[k & (FLIGHT_RECORDS - 1)];
+			if (r->time < header.start_ticks
+			    || r->time > header.dump_ticks
+			    || r->type >= NR_FLIGHT_TYPES)
+				continue;
+			if (board >= 0 && (!is_board_event(r->type)
+					   || r->a != board))
+				continue;
+			entries[nr].r = *r;
+			entries[nr].ring = j;
+			nr++;
+		}
+	}
+
+	qsort(entries, nr, sizeof(*entries), by_time);
+
+	printf("Dumped %.3f s after start", (header.dump_ns
+					     - header.start_ns) / 1e9);
+	if (header.signal)
+		printf(" on signal %d (%s)", header.signal,
+		       strsignal(header.signal));
+	printf(", %u threads, %zu records\n", header.nr_rings, nr);
+
+	if (last > 0 && nr > (size_t) last)
+		first = nr - last;
+
+	for (i = first; i < nr; i++) {
+		r = &entries[i].r;
+		rings[entries[i].ring].name[FLIGHT_NAME - 1] = '\0';
+		print_record(r, (r->time - header.start_ticks) / ticks_per_s,
+			     rings[entries[i].ring].name);
+	}
+
+	return 0;
+}
@@ -0,0 +1,505 @@
+/*
+ * Generates puzzle levels.
+ *
+ * Every worker thread draws random boards with no 3x3 block and runs a
+ * breadth-first search over rotate_row/invert_column moves to find the
+ * fewest moves that produce one.  Positions are packed into two words
+ * and deduplicated in a per-thread hash table, so each position is
+ * expanded once.  Boards whose distance falls in the requested range are
+ * kept until every distance has enough levels, then written sorted from
+ * easiest to hardest.
+ *
+ *   levelgen -o levels.dat [-n per-distance] [-m min-max] [-w width]
+ *            [-h height] [-j threads] [-s seed]
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../level.h"
+
+#define MAX_MOVES 8
+#define MAX_STATES (1u << 20)
+#define MIN_SEARCHES 64		/* before judging how often the cap is hit */
+#define PROGRESS_EVERY 65536	/* searches between progress lines */
+
+struct key {
+	uint64_t lo, hi;
+};
+
+struct search {
+	struct key *keys;
+	uint32_t *paths;
+	uint8_t *depth;
+	uint32_t *stamp;	/* slot is in use when it matches generation */
+	uint32_t generation;
+	uint32_t mask;
+	uint32_t count;
+
+	uint32_t *frontier, *next;
+};
+
+static struct {
+	int width, height;
+	int min_moves, max_moves;
+	int per_distance;
+
+	pthread_mutex_t lock;
+	int found[MAX_MOVES + 1];
+	int remaining;
+	unsigned long searches, deep, too_large;
+	struct level *levels;
+	int nr_levels;
+} gen;
+
+static uint64_t xorshift(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+
+	return x * 0x2545F4914F6CDD1Dull;
+}
+
+static struct key pack(const uint16_t *rows)
+{
+	struct key k = { 0, 0 };
+	int j;
+
+	for (j = 0; j < gen.height; j++) {
+		if (j < 6)
+			k.lo |= (uint64_t) rows[j] << (j * 10);
+		else
+			k.hi |= (uint64_t) rows[j] << ((j - 6) * 10);
+	}
+
+	return k;
+}
+
+static void unpack(struct key k, uint16_t *rows)
+{
+	int j;
+
+	for (j = 0; j < gen.height; j++) {
+		if (j < 6)
+			rows[j] = (k.lo >> (j * 10)) & 0x3FF;
+		else
+			rows[j] = (k.hi >> ((j - 6) * 10)) & 0x3FF;
+	}
+}
+
+static uint32_t hash_key(struct key k)
+{
+	uint64_t h = k.lo * 0x9E3779B97F4A7C15ull ^ k.hi * 0xC2B2AE3D27D4EB4Full;
+
+	return h ^ (h >> 32);
+}
+
+static int search_init(struct search *s)
+{
+	uint32_t slots = MAX_STATES * 2;
+
+	s->mask = slots - 1;
+	s->keys = malloc(slots * sizeof(*s->keys));
+	s->paths = malloc(slots * sizeof(*s->paths));
+	s->depth = malloc(slots);
+	s->stamp = calloc(slots, sizeof(*s->stamp));
+	s->generation = 0;
+	s->frontier = malloc(MAX_STATES * sizeof(*s->frontier));
+	s->next = malloc(MAX_STATES * sizeof(*s->next));
+
+	return s->keys && s->paths && s->depth && s->stamp
+		&& s->frontier && s->next ? 0 : 1;
+}
+
+/* Returns the slot holding k, inserting it if needed; *added tells which. */
+static uint32_t search_insert(struct search *s, struct key k, int *added)
+{
+	uint32_t i = hash_key(k) & s->mask;
+
+	while (s->stamp[i] == s->generation) {
+		if (s->keys[i].lo == k.lo && s->keys[i].hi == k.hi) {
+			*added = 0;
+			return i;
+		}
+		i = (i + 1) & s->mask;
+	}
+
+	s->stamp[i] = s->generation;
+	s->keys[i] = k;
+	s->count++;
+	*added = 1;
+
+	return i;
+}
+
+/*
+ * Returns the fewest moves that make a 3x3 block from rows, 0 if there is
+ * none within max_moves, or -1 if the search grew past MAX_STATES first.
+ * *solutions is set to the number of distinct move sequences of that
+ * length.
+ */
+static int distance(struct search *s, const uint16_t *start, int max_moves,
+		    unsigned int *solutions)
+{
+	uint16_t rows[LEVEL_MAX_ROWS];
+	uint16_t moved[LEVEL_MAX_ROWS];
+	uint32_t nr_frontier, nr_next, *tmp;
+	uint32_t i, slot, from;
+	uint64_t paths;
+	int d, m, added;
+	int moves = gen.height + gen.width;
+	int result = 0;
+
+	s->generation++;
+	s->count = 0;
+
+	slot = search_insert(s, pack(start), &added);
+	s->paths[slot] = 1;
+	s->depth[slot] = 0;
+	s->frontier[0] = slot;
+	nr_frontier = 1;
+
+	for (d = 1; d <= max_moves && nr_frontier > 0; d++) {
+		nr_next = 0;
+
+		for (i = 0; i < nr_frontier; i++) {
+			from = s->frontier[i];
+			unpack(s->keys[from], rows);
+
+			for (m = 0; m < moves; m++) {
+				memcpy(moved, rows, sizeof(rows));
+				if (m < gen.height)
+					moved[m] = level_rotate_row(moved[m],
+								    gen.width);
+				else
+					level_invert_column(moved, gen.height,
+							    m - gen.height);
+
+				slot = search_insert(s, pack(moved), &added);
+				if (added) {
+					if (s->count >= MAX_STATES)
+						return -1;
+					s->depth[slot] = d;
+					s->paths[slot] = 0;
+					s->next[nr_next++] = slot;
+				} else if (s->depth[slot] != d) {
+					continue;
+				}
+
+				paths = (uint64_t) s->paths[slot]
+					+ s->paths[from];
+				s->paths[slot] = paths > UINT32_MAX
+					? UINT32_MAX : paths;
+			}
+		}
+
+		paths = 0;
+		for (i = 0; i < nr_next; i++) {
+			unpack(s->keys[s->next[i]], rows);
+			if (level_has_block(rows, gen.width, gen.height)) {
+				result = d;
+				paths += s->paths[s->next[i]];
+			}
+		}
+
+		if (result) {
+			*solutions = paths > 0xFFFF ? 0xFFFF : paths;
+			return result;
+		}
+
+		tmp = s->frontier;
+		s->frontier = s->next;
+		s->next = tmp;
+		nr_frontier = nr_next;
+	}
+
+	return 0;
+}
+
+static void random_board(uint64_t *rng, uint16_t *rows)
+{
+	int j;
+
+	do {
+		for (j = 0; j < gen.height; j++)
+			rows[j] = xorshift(rng) & level_row_mask(gen.width);
+	} while (level_has_block(rows, gen.width, gen.height));
+}
+
+/* Called with gen.lock held. */
+static void progress(void)
+{
+	fprintf(stderr, "\r%d levels to go, %lu boards searched   ",
+		gen.remaining, gen.searches);
+}
+
+static void add_level(const uint16_t *rows, int moves, unsigned int solutions)
+{
+	struct level *level;
+
+	pthread_mutex_lock(&gen.lock);
+
+	if (gen.found[moves] < gen.per_distance) {
+		level = &gen.levels[gen.nr_levels++];
+		memset(level, 0, sizeof(*level));
+		level->width = gen.width;
+		level->height = gen.height;
+		level->moves = moves;
+		level->solutions = solutions;
+		memcpy(level->rows, rows, gen.height * sizeof(*rows));
+
+		gen.found[moves]++;
+		gen.remaining--;
+
+		progress();
+	}
+
+	pthread_mutex_unlock(&gen.lock);
+}
+
+static int wanted(int moves)
+{
+	int want;
+
+	pthread_mutex_lock(&gen.lock);
+	want = moves >= gen.min_moves && gen.found[moves] < gen.per_distance;
+	pthread_mutex_unlock(&gen.lock);
+
+	return want;
+}
+
+/*
+ * Counts a search; returns non-zero once most searches that got past
+ * min_moves - 1 without a block gave up at MAX_STATES, as then the
+ * requested depths are out of reach for this size.
+ * Big boards rarely need many moves, so finding those can take long;
+ * progress is shown either way.
+ */
+static int too_large(int moves)
+{
+	int give_up;
+
+	pthread_mutex_lock(&gen.lock);
+	if (++gen.searches % PROGRESS_EVERY == 0)
+		progress();
+	if (moves <= 0 || moves >= gen.min_moves)
+		gen.deep++;
+	if (moves < 0)
+		gen.too_large++;
+	give_up = gen.deep >= MIN_SEARCHES && gen.too_large * 2 > gen.deep;
+	pthread_mutex_unlock(&gen.lock);
+
+	return give_up;
+}
+
+static int done(void)
+{
+	int remaining;
+
+	pthread_mutex_lock(&gen.lock);
+	remaining = gen.remaining;
+	pthread_mutex_unlock(&gen.lock);
+
+	return remaining == 0;
+}
+
+static void *worker(void *data)
+{
+	uint64_t rng = (uint64_t) (uintptr_t) data;
+	uint16_t rows[LEVEL_MAX_ROWS];
+	struct search s;
+	unsigned int solutions = 0;
+	int moves;
+
+	if (search_init(&s) != 0) {
+		fprintf(stderr, "Could not allocate search tables.\n");
+		exit(1);
+	}
+
+	while (!done()) {
+		random_board(&rng, rows);
+
+		moves = distance(&s, rows, gen.max_moves, &solutions);
+		if (too_large(moves)) {
+			fprintf(stderr, "\nSearches to %d moves on %dx%d boards "
+				"pass %u positions; lower the -m maximum.\n",
+				gen.max_moves, gen.width, gen.height,
+				MAX_STATES);
+			exit(1);
+		}
+		if (moves > 0 && wanted(moves))
+			add_level(rows, moves, solutions);
+	}
+
+	free(s.keys);
+	free(s.paths);
+	free(s.depth);
+	free(s.stamp);
+	free(s.frontier);
+	free(s.next);
+
+	return NULL;
+}
+
+/* Easiest first: fewer moves, then more ways to solve it. */
+static int compare_levels(const void *a, const void *b)
+{
+	const struct level *la = a;
+	const struct level *lb = b;
+
+	if (la->moves != lb->moves)
+		return la->moves - lb->moves;
+
+	return lb->solutions - la->solutions;
+}
+
+static int write_levels(const char *filename)
+{
+	struct level_header header;
+	FILE *out;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LEVEL_MAGIC, sizeof(header.magic));
+	header.count = gen.nr_levels;
+
+	out = fopen(filename, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "Could not open %s: %s\n",
+			filename, strerror(errno));
+		return 1;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, out) != 1
+	    || fwrite(gen.levels, sizeof(*gen.levels), gen.nr_levels, out)
+	       != (size_t) gen.nr_levels) {
+		fprintf(stderr, "Could not write %s: %s\n",
+			filename, strerror(errno));
+		fclose(out);
+		return 1;
+	}
+
+	return fclose(out) == 0 ? 0 : 1;
+}
+
+/* Parses "n" or "min-max"; returns 1 if s is neither. */
+static int parse_range(const char *s, int *min, int *max)
+{
+	char *end;
+
+	*min = strtol(s, &end, 10);
+	*max = *min;
+	if (end == s)
+		return 1;
+
+	if (*end == '-') {
+		s = end + 1;
+		*max = strtol(s, &end, 10);
+		if (end == s)
+			return 1;
+	}
+
+	return *end != '\0';
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s -o levels.dat [-n per-distance] "
+		"[-m min-max] [-w width] [-h height] [-j threads] [-s seed]\n",
+		argv0);
+}
+
+int main(int argc, char **argv)
+{
+	const char *output = NULL;
+	unsigned long seed = 1;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *tids;
+	int opt;
+	long i;
+
+	_Static_assert(sizeof(struct level) == 32, "level record size");
+
+	gen.width = LEVEL_MAX_WIDTH;
+	gen.height = LEVEL_MAX_ROWS;
+	gen.min_moves = 1;
+	gen.max_moves = 3;
+	gen.per_distance = 10;
+
+	while ((opt = getopt(argc, argv, "o:n:m:w:h:j:s:")) != -1) {
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'n':
+			gen.per_distance = atoi(optarg);
+			break;
+		case 'm':
+			if (parse_range(optarg, &gen.min_moves,
+					&gen.max_moves) != 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'w':
+			gen.width = atoi(optarg);
+			break;
+		case 'h':
+			gen.height = atoi(optarg);
+			break;
+		case 'j':
+			threads = atol(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (output == NULL || gen.per_distance < 1
+	    || gen.width < 3 || gen.width > LEVEL_MAX_WIDTH
+	    || gen.height < 3 || gen.height > LEVEL_MAX_ROWS
+	    || gen.min_moves < 1 || gen.max_moves > MAX_MOVES
+	    || gen.min_moves > gen.max_moves || threads < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	gen.remaining = gen.per_distance * (gen.max_moves - gen.min_moves + 1);
+	gen.levels = malloc(gen.remaining * sizeof(*gen.levels));
+	tids = malloc(threads * sizeof(*tids));
+	if (gen.levels == NULL || tids == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+	pthread_mutex_init(&gen.lock, NULL);
+
+	for (i = 0; i < threads; i++) {
+		/* xorshift state must be non-zero */
+		uintptr_t rng = seed * 0x9E3779B97F4A7C15ull + i + 1;
+
+		if (pthread_create(&tids[i], NULL, worker, (void *) rng) != 0) {
+			fprintf(stderr, "Could not start thread.\n");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < threads; i++)
+		pthread_join(tids[i], NULL);
+
+	fprintf(stderr, "\n");
+
+	qsort(gen.levels, gen.nr_levels, sizeof(*gen.levels), compare_levels);
+
+	return write_levels(output);
+}
@@ -0,0 +1,302 @@
+/*
+ * Headless spectator: follows a game started with -S and rebuilds its
+ * board from the stream, over any number of connections at once.
+ *
+ *   spectate [-n connections] [-l slow] [-d seconds] [-p] address
+ *
+ * address is [host:]port or unix:path, as given to the game.  The first
+ * slow connections only read a little once a second, so the game has to
+ * skip them forward.  Every keyframe is checked against the board the
+ * connection built from the messages before it; a difference means the
+ * connection was skipped forward or the stream is wrong.  -p draws the
+ * first connection's board every second.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../spectate.h"
+
+#define BUFFER 4096
+#define SLOW_READ 256		/* bytes a slow connection reads a second */
+
+struct conn {
+	int fd;
+	uint8_t buf[BUFFER];
+	size_t len;
+	int synced;		/* has seen a keyframe */
+	struct spec_board board;
+
+	unsigned long long bytes;
+	unsigned long messages;
+	unsigned long keyframes;
+	unsigned long resyncs;
+};
+
+static struct sockaddr_storage addr;
+static socklen_t addr_len;
+
+static int parse_address(const char *address)
+{
+	struct sockaddr_un *un = (struct sockaddr_un *) &addr;
+	struct sockaddr_in *in = (struct sockaddr_in *) &addr;
+	char host[64] = "127.0.0.1";
+	const char *colon;
+
+	memset(&addr, 0, sizeof(addr));
+
+	if (strncmp(address, "unix:", 5) == 0) {
+		if (strlen(address + 5) >= sizeof(un->sun_path))
+			return 1;
+		un->sun_family = AF_UNIX;
+		strcpy(un->sun_path, address + 5);
+		addr_len = sizeof(*un);
+		return 0;
+	}
+
+	colon = strrchr(address, ':');
+	if (colon && (size_t) (colon - address) < sizeof(host)) {
+		memcpy(host, address, colon - address);
+		host[colon - address] = '\0';
+		address = colon + 1;
+	}
+
+	in->sin_family = AF_INET;
+	in->sin_port = htons(atoi(address));
+	addr_len = sizeof(*in);
+
+	return inet_pton(AF_INET, host, &in->sin_addr) == 1 ? 0 : 1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Applies every whole message in the buffer; returns 1 on a bad one. */
+static int consume(struct conn *c)
+{
+	struct spec_board before;
+	size_t off = 0;
+	int n;
+
+	while (off < c->len) {
+		if (!c->synced && c->buf[off] != SPEC_KEYFRAME)
+			return 1;
+
+		before = c->board;
+		n = spec_apply(&c->board, c->buf + off, c->len - off);
+		if (n < 0)
+			return 1;
+		if (n == 0)
+			break;
+
+		if (c->buf[off] == SPEC_KEYFRAME) {
+			if (c->synced && memcmp(&before, &c->board,
+						sizeof(before)) != 0)
+				c->resyncs++;
+			c->synced = 1;
+			c->keyframes++;
+		}
+
+		c->messages++;
+		off += n;
+	}
+
+	memmove(c->buf, c->buf + off, c->len - off);
+	c->len -= off;
+
+	return 0;
+}
+
+/*
+ * Reads up to limit bytes, or all there is if limit is 0.  Returns 1
+ * once the connection is closed or broken.
+ */
+static int read_conn(struct conn *c, size_t limit)
+{
+	size_t want;
+	ssize_t n;
+
+	for (;;) {
+		want = BUFFER - c->len;
+		if (limit && want > limit)
+			want = limit;
+
+		n = read(c->fd, c->buf + c->len, want);
+		if (n < 0)
+			return errno == EAGAIN || errno == EINTR ? 0 : 1;
+		if (n == 0)
+			return 1;
+
+		c->bytes += n;
+		c->len += n;
+		if (consume(c) != 0) {
+			fprintf(stderr, "Bad message on connection %d.\n",
+				c->fd);
+			return 1;
+		}
+
+		if (limit)
+			return 0;
+	}
+}
+
+static void print_board(const struct spec_board *b)
+{
+	static const char cells[] = ".#O";
+	int i, j;
+
+	printf("score %u\n", b->score);
+	for (j = 0; j < SPECTATE_HEIGHT; j++) {
+		for (i = 0; i < SPECTATE_WIDTH; i++)
+			putchar(cells[b->cells[i * SPECTATE_HEIGHT + j] % 3]);
+		putchar('\n');
+	}
+	for (i = 0; i < SPECTATE_WIDTH; i++)
+		putchar(cells[b->new_row[i] % 3]);
+	printf("\n\n");
+}
+
+static void print_summary(const struct conn *conns, int nr, int open)
+{
+	unsigned long long bytes = 0;
+	unsigned long messages = 0, keyframes = 0, resyncs = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		bytes += conns[i].bytes;
+		messages += conns[i].messages;
+		keyframes += conns[i].keyframes;
+		resyncs += conns[i].resyncs;
+	}
+
+	printf("%d/%d connected, %llu bytes, %lu messages, %lu keyframes, "
+	       "%lu resyncs\n", open, nr, bytes, messages, keyframes,
+	       resyncs);
+	fflush(stdout);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-n connections] [-l slow] [-d seconds] "
+		"[-p] [host:]port|unix:path\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+	struct epoll_event ev, events[64];
+	struct conn *conns, *c;
+	int nr_conns = 1, slow = 0, print = 0;
+	double duration = 0, start, last;
+	int epoll_fd, open_conns;
+	int opt, i, n;
+
+	while ((opt = getopt(argc, argv, "n:l:d:p")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_conns = atoi(optarg);
+			break;
+		case 'l':
+			slow = atoi(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'p':
+			print = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1 || nr_conns < 1
+	    || parse_address(argv[optind]) != 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	conns = calloc(nr_conns, sizeof(*conns));
+	epoll_fd = epoll_create1(0);
+	if (conns == NULL || epoll_fd < 0) {
+		fprintf(stderr, "Could not set up: %s\n", strerror(errno));
+		return 1;
+	}
+
+	for (i = 0; i < nr_conns; i++) {
+		c = &conns[i];
+		c->fd = socket(addr.ss_family, SOCK_STREAM, 0);
+		if (c->fd < 0 || connect(c->fd, (struct sockaddr *) &addr,
+					 addr_len) < 0) {
+			fprintf(stderr, "Could not connect: %s\n",
+				strerror(errno));
+			return 1;
+		}
+		fcntl(c->fd, F_SETFL, O_NONBLOCK);
+
+		/* Slow connections are read by the timer below instead. */
+		if (i < slow)
+			continue;
+
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+			fprintf(stderr, "Could not watch connection: %s\n",
+				strerror(errno));
+			return 1;
+		}
+	}
+
+	open_conns = nr_conns;
+	start = last = now();
+
+	while (open_conns > 0 && (duration == 0 || now() - start < duration)) {
+		n = epoll_wait(epoll_fd, events, 64, 100);
+
+		for (i = 0; i < n; i++) {
+			c = &conns[events[i].data.u32];
+			if (read_conn(c, 0) != 0) {
+				close(c->fd);
+				c->fd = -1;
+				open_conns--;
+			}
+		}
+
+		if (now() - last < 1)
+			continue;
+		last = now();
+
+		for (i = 0; i < slow; i++) {
+			c = &conns[i];
+			if (c->fd >= 0 && read_conn(c, SLOW_READ) != 0) {
+				close(c->fd);
+				c->fd = -1;
+				open_conns--;
+			}
+		}
+
+		if (print && conns[0].synced)
+			print_board(&conns[0].board);
+		print_summary(conns, nr_conns, open_conns);
+	}
+
+	print_summary(conns, nr_conns, open_conns);
+
+	return 0;
+}
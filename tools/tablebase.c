@@ -0,0 +1,453 @@
+/*
+ * Builds a puzzle tablebase for one board size (see tablebase.h).
+ *
+ * Every board of width x height cells gets a distance byte.  Boards that
+ * already hold a 3x3 block are at distance 0; the search then runs the
+ * moves backwards, level by level, each level being a parallel sweep
+ * over all boards that marks the unseen predecessors of the boards found
+ * in the level before.  Several threads may mark the same board, but
+ * always with the same value.  The canonical boards are then given a
+ * perfect hash, the table is written, and every board is looked up
+ * through it once to check it.
+ *
+ *   tablebase -o table.tb -w width -h height [-j threads] [-s seed]
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../tablebase.h"
+
+#define KEYS_PER_BUCKET 4
+#define MAX_PILOT 0xFFFF
+#define MAX_SEEDS 16
+
+static struct {
+	int width, height;
+	uint32_t nr_states;
+	uint32_t row_mask;
+	uint32_t column_masks[LEVEL_MAX_WIDTH];
+
+	uint8_t *distance;	/* by key */
+	uint32_t *keys;		/* canonical keys */
+	uint32_t nr_keys;
+
+	struct tablebase_header header;
+	uint16_t *pilots;
+	uint8_t *table;
+} tb;
+
+struct job {
+	pthread_t tid;
+	uint32_t first, last;	/* range of keys */
+	uint8_t level;
+	uint32_t found;
+	uint32_t *out;
+};
+
+static long nr_threads;
+
+/* Runs fn over all keys split into one range per thread. */
+static uint32_t run(void *(*fn)(void *), struct job *jobs, uint8_t level)
+{
+	uint32_t found = 0;
+	long i;
+
+	for (i = 0; i < nr_threads; i++) {
+		jobs[i].first = (uint64_t) tb.nr_states * i / nr_threads;
+		jobs[i].last = (uint64_t) tb.nr_states * (i + 1) / nr_threads;
+		jobs[i].level = level;
+		jobs[i].found = 0;
+		if (pthread_create(&jobs[i].tid, NULL, fn, &jobs[i]) != 0) {
+			fprintf(stderr, "Could not start thread.\n");
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(jobs[i].tid, NULL);
+		found += jobs[i].found;
+	}
+
+	return found;
+}
+
+static void *find_blocks(void *data)
+{
+	struct job *job = data;
+	uint16_t rows[LEVEL_MAX_ROWS];
+	uint32_t key;
+	int j;
+
+	for (key = job->first; key < job->last; key++) {
+		for (j = 0; j < tb.height; j++)
+			rows[j] = key >> (j * tb.width) & tb.row_mask;
+
+		if (level_has_block(rows, tb.width, tb.height)) {
+			tb.distance[key] = 0;
+			job->found++;
+		}
+	}
+
+	return NULL;
+}
+
+/* Threads may race to count a board twice, but never to miss one. */
+static void mark(struct job *job, uint32_t key)
+{
+	if (__atomic_load_n(&tb.distance[key], __ATOMIC_RELAXED)
+	    != TABLEBASE_UNSOLVABLE)
+		return;
+
+	__atomic_store_n(&tb.distance[key], job->level + 1, __ATOMIC_RELAXED);
+	job->found++;
+}
+
+/* Marks every board one move before a board at job->level. */
+static void *expand(void *data)
+{
+	struct job *job = data;
+	uint32_t key, row, shift;
+	int i, j;
+
+	for (key = job->first; key < job->last; key++) {
+		if (tb.distance[key] != job->level)
+			continue;
+
+		/* Undoing a rotation to the right is one to the left. */
+		for (j = 0; j < tb.height; j++) {
+			shift = j * tb.width;
+			row = key >> shift & tb.row_mask;
+			row = (row >> 1 | row << (tb.width - 1)) & tb.row_mask;
+			mark(job, (key & ~(tb.row_mask << shift))
+			     | row << shift);
+		}
+
+		for (i = 0; i < tb.width; i++)
+			mark(job, key ^ tb.column_masks[i]);
+	}
+
+	return NULL;
+}
+
+static void *count_canonical(void *data)
+{
+	struct job *job = data;
+	uint32_t key;
+
+	for (key = job->first; key < job->last; key++)
+		if (tablebase_canonical(key, tb.width, tb.height) == key) {
+			if (job->out)
+				*job->out++ = key;
+			job->found++;
+		}
+
+	return NULL;
+}
+
+static int slot_taken(const uint8_t *taken, uint32_t slot)
+{
+	return taken[slot / 8] & (1 << slot % 8);
+}
+
+/*
+ * Finds a pilot for every bucket, largest buckets first, such that all
+ * keys land in different slots.  Returns 1 if some bucket has none.
+ */
+static int build_hash(uint64_t seed)
+{
+	struct tablebase_header *h = &tb.header;
+	uint32_t *start, *order, *sizes, *slots, *by_size;
+	uint64_t *hashes, hash;
+	uint8_t *taken;
+	uint32_t b, i, k, m, n, slot, pilot, max_size = 0;
+	int ok = 1;
+
+	h->seed = seed;
+	h->nr_keys = tb.nr_keys;
+	h->nr_buckets = tb.nr_keys / KEYS_PER_BUCKET + 1;
+	h->nr_slots = tb.nr_keys + tb.nr_keys / 20 + 1;
+
+	hashes = malloc(tb.nr_keys * sizeof(*hashes));
+	start = calloc(h->nr_buckets + 1, sizeof(*start));
+	sizes = calloc(h->nr_buckets, sizeof(*sizes));
+	order = malloc(h->nr_buckets * sizeof(*order));
+	taken = calloc(h->nr_slots / 8 + 1, 1);
+	tb.pilots = calloc(h->nr_buckets, sizeof(*tb.pilots));
+	if (hashes == NULL || start == NULL || sizes == NULL || order == NULL
+	    || taken == NULL || tb.pilots == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	/* Group the hashes by bucket. */
+	for (i = 0; i < tb.nr_keys; i++) {
+		b = tablebase_bucket(h, tablebase_mix(tb.keys[i] ^ seed));
+		sizes[b]++;
+	}
+	for (b = 0; b < h->nr_buckets; b++) {
+		start[b + 1] = start[b] + sizes[b];
+		if (sizes[b] > max_size)
+			max_size = sizes[b];
+	}
+	memset(sizes, 0, h->nr_buckets * sizeof(*sizes));
+	for (i = 0; i < tb.nr_keys; i++) {
+		hash = tablebase_mix(tb.keys[i] ^ seed);
+		b = tablebase_bucket(h, hash);
+		hashes[start[b] + sizes[b]++] = hash;
+	}
+
+	/* Largest buckets first, while the table is still empty. */
+	by_size = calloc(max_size + 2, sizeof(*by_size));
+	slots = malloc((max_size + 1) * sizeof(*slots));
+	if (by_size == NULL || slots == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	for (b = 0; b < h->nr_buckets; b++)
+		by_size[max_size - sizes[b] + 1]++;
+	for (k = 1; k <= max_size + 1; k++)
+		by_size[k] += by_size[k - 1];
+	for (b = 0; b < h->nr_buckets; b++)
+		order[by_size[max_size - sizes[b]]++] = b;
+
+	for (i = 0; i < h->nr_buckets && ok; i++) {
+		b = order[i];
+		n = sizes[b];
+		if (n == 0)
+			break;
+
+		for (pilot = 0; pilot <= MAX_PILOT; pilot++) {
+			for (k = 0; k < n; k++) {
+				slot = tablebase_slot(h, hashes[start[b] + k],
+						      pilot);
+				if (slot_taken(taken, slot))
+					break;
+				for (m = 0; m < k && slots[m] != slot; m++)
+					;
+				if (m < k)
+					break;
+				slots[k] = slot;
+			}
+			if (k == n)
+				break;
+		}
+
+		if (pilot > MAX_PILOT) {
+			ok = 0;
+			break;
+		}
+
+		tb.pilots[b] = pilot;
+		for (k = 0; k < n; k++)
+			taken[slots[k] / 8] |= 1 << slots[k] % 8;
+	}
+
+	free(hashes);
+	free(start);
+	free(sizes);
+	free(order);
+	free(taken);
+	free(by_size);
+	free(slots);
+
+	if (!ok) {
+		free(tb.pilots);
+		tb.pilots = NULL;
+	}
+
+	return ok ? 0 : 1;
+}
+
+static void *check(void *data)
+{
+	struct job *job = data;
+	uint32_t key, canonical;
+
+	for (key = job->first; key < job->last; key++) {
+		canonical = tablebase_canonical(key, tb.width, tb.height);
+		if (tablebase_lookup(&tb.header, tb.pilots, tb.table,
+				     canonical) != tb.distance[key])
+			job->found++;
+	}
+
+	return NULL;
+}
+
+static int write_table(const char *filename)
+{
+	FILE *out;
+
+	out = fopen(filename, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "Could not open %s: %s\n",
+			filename, strerror(errno));
+		return 1;
+	}
+
+	if (fwrite(&tb.header, sizeof(tb.header), 1, out) != 1
+	    || fwrite(tb.pilots, sizeof(*tb.pilots), tb.header.nr_buckets, out)
+	       != tb.header.nr_buckets
+	    || fwrite(tb.table, 1, tb.header.nr_slots, out)
+	       != tb.header.nr_slots) {
+		fprintf(stderr, "Could not write %s: %s\n",
+			filename, strerror(errno));
+		fclose(out);
+		return 1;
+	}
+
+	return fclose(out) == 0 ? 0 : 1;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s -o table.tb -w width -h height "
+		"[-j threads] [-s seed]\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+	const char *output = NULL;
+	unsigned long seed = 1;
+	uint32_t counts[256] = { 0 };
+	uint32_t found, key, wrong, i;
+	struct job *jobs;
+	uint64_t hash;
+	int level, opt, j;
+
+	_Static_assert(sizeof(struct tablebase_header) == 32,
+		       "tablebase header size");
+
+	nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "o:w:h:j:s:")) != -1) {
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'w':
+			tb.width = atoi(optarg);
+			break;
+		case 'h':
+			tb.height = atoi(optarg);
+			break;
+		case 'j':
+			nr_threads = atol(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (output == NULL || nr_threads < 1
+	    || tb.width < 3 || tb.width > LEVEL_MAX_WIDTH
+	    || tb.height < 3 || tb.height > LEVEL_MAX_ROWS
+	    || tb.width * tb.height > TABLEBASE_MAX_CELLS) {
+		usage(argv[0]);
+		fprintf(stderr, "Boards must be at least 3x3 and have at most "
+			"%d cells.\n", TABLEBASE_MAX_CELLS);
+		return 1;
+	}
+
+	tb.nr_states = 1u << (tb.width * tb.height);
+	tb.row_mask = level_row_mask(tb.width);
+	for (i = 0; i < (uint32_t) tb.width; i++)
+		for (j = 0; j < tb.height; j++)
+			tb.column_masks[i] |= 1u << (j * tb.width + i);
+
+	tb.distance = malloc(tb.nr_states);
+	jobs = calloc(nr_threads, sizeof(*jobs));
+	if (tb.distance == NULL || jobs == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+	memset(tb.distance, TABLEBASE_UNSOLVABLE, tb.nr_states);
+
+	found = run(find_blocks, jobs, 0);
+	fprintf(stderr, "%u of %u boards hold a block\n", found,
+		tb.nr_states);
+
+	for (level = 0; level < TABLEBASE_UNSOLVABLE - 1; level++) {
+		found = run(expand, jobs, level);
+		if (found == 0)
+			break;
+		fprintf(stderr, "distance %d: about %u boards\n", level + 1,
+			found);
+	}
+
+	/* Count, then collect, the canonical keys in key order. */
+	run(count_canonical, jobs, 0);
+	for (i = 0; i < nr_threads; i++)
+		tb.nr_keys += jobs[i].found;
+	tb.keys = malloc(tb.nr_keys * sizeof(*tb.keys));
+	if (tb.keys == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+	for (i = 0, found = 0; i < nr_threads; found += jobs[i].found, i++)
+		jobs[i].out = tb.keys + found;
+	run(count_canonical, jobs, 0);
+
+	for (i = 0; i < MAX_SEEDS; i++, seed++)
+		if (build_hash(seed) == 0)
+			break;
+	if (i == MAX_SEEDS) {
+		fprintf(stderr, "Could not build a perfect hash.\n");
+		return 1;
+	}
+
+	memcpy(tb.header.magic, TABLEBASE_MAGIC, sizeof(tb.header.magic));
+	tb.header.width = tb.width;
+	tb.header.height = tb.height;
+
+	tb.table = malloc(tb.header.nr_slots);
+	if (tb.table == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+	memset(tb.table, TABLEBASE_UNSOLVABLE, tb.header.nr_slots);
+
+	for (i = 0; i < tb.nr_keys; i++) {
+		key = tb.keys[i];
+		hash = tablebase_mix(key ^ tb.header.seed);
+
+		tb.table[tablebase_slot(&tb.header, hash,
+					tb.pilots[tablebase_bucket(&tb.header,
+								   hash)])]
+			= tb.distance[key];
+		counts[tb.distance[key]]++;
+		if (tb.distance[key] != TABLEBASE_UNSOLVABLE
+		    && tb.distance[key] > tb.header.max_distance)
+			tb.header.max_distance = tb.distance[key];
+	}
+
+	wrong = run(check, jobs, 0);
+	if (wrong) {
+		fprintf(stderr, "%u boards look up the wrong distance.\n",
+			wrong);
+		return 1;
+	}
+
+	if (write_table(output) != 0)
+		return 1;
+
+	printf("%dx%d: %u boards, %u canonical, %u buckets, %u slots, "
+	       "%zu bytes\n", tb.width, tb.height, tb.nr_states, tb.nr_keys,
+	       tb.header.nr_buckets, tb.header.nr_slots,
+	       sizeof(tb.header) + tb.header.nr_buckets * sizeof(*tb.pilots)
+	       + tb.header.nr_slots);
+	for (level = 0; level <= tb.header.max_distance; level++)
+		printf("  %2d moves: %u\n", level, counts[level]);
+	if (counts[TABLEBASE_UNSOLVABLE])
+		printf("  unsolvable: %u\n", counts[TABLEBASE_UNSOLVABLE]);
+
+	return 0;
+}
@@ -0,0 +1,199 @@
+/*
+ * Displays the live counters a running game publishes in shared memory.
+ *
+ *   telemetry [pid]      refresh one line per second
+ *   telemetry -1 [pid]   print every counter once as "name value" and exit
+ *
+ * Each game has its own block; without a pid the one live game is
+ * found in /dev/shm, where blocks of games that crashed are skipped.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../telemetry.h"
+
+#define MAX_GAMES 16
+
+static int is_alive(long pid)
+{
+	return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+/* The pid of the only live game publishing telemetry, or 0. */
+static long find_game(void)
+{
+	const char *prefix = TELEMETRY_NAME + 1;
+	size_t len = strlen(prefix);
+	long pids[MAX_GAMES], pid;
+	struct dirent *e;
+	DIR *dir;
+	int n = 0, i;
+
+	dir = opendir("/dev/shm");
+	if (dir == NULL) {
+		perror("/dev/shm");
+		return 0;
+	}
+
+	while ((e = readdir(dir)) != NULL) {
+		if (strncmp(e->d_name, prefix, len) != 0
+		    || e->d_name[len] != '-')
+			continue;
+		pid = atol(e->d_name + len + 1);
+		if (pid > 0 && is_alive(pid) && n < MAX_GAMES)
+			pids[n++] = pid;
+	}
+	closedir(dir);
+
+	if (n == 1)
+		return pids[0];
+
+	if (n == 0) {
+		fprintf(stderr, "No game is publishing telemetry.\n");
+	} else {
+		fprintf(stderr, "Several games are running; give a pid:");
+		for (i = 0; i < n; i++)
+			fprintf(stderr, " %ld", pids[i]);
+		fprintf(stderr, "\n");
+	}
+
+	return 0;
+}
+
+static struct telemetry *open_telemetry(long pid)
+{
+	char name[TELEMETRY_NAME_MAX];
+	struct telemetry *t;
+	int fd;
+
+	snprintf(name, sizeof(name), TELEMETRY_NAME "-%ld", pid);
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open shared memory %s: %s\n",
+			name, strerror(errno));
+		return NULL;
+	}
+
+	t = mmap(NULL, sizeof(*t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (t == MAP_FAILED) {
+		fprintf(stderr, "Could not map shared memory %s: %s\n",
+			name, strerror(errno));
+		return NULL;
+	}
+
+	if (__atomic_load_n(&t->magic, __ATOMIC_ACQUIRE) != TELEMETRY_MAGIC
+	    || t->version != TELEMETRY_VERSION) {
+		fprintf(stderr, "%s has an unknown layout.\n", name);
+		return NULL;
+	}
+
+	return t;
+}
+
+static void print_once(const struct telemetry *t)
+{
+	int i;
+
+	printf("pid %llu\n", (unsigned long long) t->pid);
+	printf("frames %llu\n",
+	       (unsigned long long) telemetry_get(t, frames));
+	printf("frame_time_us %llu\n",
+	       (unsigned long long) telemetry_get(t, frame_time_us));
+	printf("fps %llu\n", (unsigned long long) telemetry_get(t, fps));
+	printf("update_us %llu\n",
+	       (unsigned long long) telemetry_get(t, update_us));
+	printf("draw_us %llu\n",
+	       (unsigned long long) telemetry_get(t, draw_us));
+	printf("particles %llu\n",
+	       (unsigned long long) telemetry_get(t, particles));
+	printf("falling_cells %llu\n",
+	       (unsigned long long) telemetry_get(t, falling_cells));
+	printf("clears %llu\n",
+	       (unsigned long long) telemetry_get(t, clears));
+	printf("score %llu\n", (unsigned long long) telemetry_get(t, score));
+	printf("tweens");
+	for (i = 0; i < TELEMETRY_TWEENS; i++)
+		printf(" %llu",
+		       (unsigned long long) telemetry_get(t, tweens[i]));
+	printf("\n");
+}
+
+static void print_line(const struct telemetry *t)
+{
+	printf("%10llu %6llu %5llu %8llu %8llu %9llu %7llu %6llu %8llu\n",
+	       (unsigned long long) telemetry_get(t, frames),
+	       (unsigned long long) telemetry_get(t, fps),
+	       (unsigned long long) telemetry_get(t, frame_time_us),
+	       (unsigned long long) telemetry_get(t, update_us),
+	       (unsigned long long) telemetry_get(t, draw_us),
+	       (unsigned long long) telemetry_get(t, particles),
+	       (unsigned long long) telemetry_get(t, falling_cells),
+	       (unsigned long long) telemetry_get(t, clears),
+	       (unsigned long long) telemetry_get(t, score));
+}
+
+int main(int argc, char **argv)
+{
+	const struct telemetry *t;
+	long pid;
+	int once = 0;
+	int opt;
+	int lines = 0;
+
+	while ((opt = getopt(argc, argv, "1")) != -1) {
+		switch (opt) {
+		case '1':
+			once = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-1] [pid]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc - 1) {
+		fprintf(stderr, "usage: %s [-1] [pid]\n", argv[0]);
+		return 1;
+	}
+
+	pid = optind < argc ? atol(argv[optind]) : find_game();
+	if (pid <= 0)
+		return 1;
+
+	t = open_telemetry(pid);
+	if (t == NULL)
+		return 1;
+
+	if (once) {
+		print_once(t);
+		return 0;
+	}
+
+	for (;;) {
+		if (!is_alive(t->pid)) {
+			fprintf(stderr, "Game %llu has exited.\n",
+				(unsigned long long) t->pid);
+			return 1;
+		}
+
+		if (lines++ % 20 == 0)
+			printf("%10s %6s %5s %8s %8s %9s %7s %6s %8s\n",
+			       "frames", "fps", "us", "update", "draw",
+			       "particles", "falling", "clears", "score");
+		print_line(t);
+		fflush(stdout);
+		sleep(1);
+	}
+
+	return 0;
+}